@@ -1,24 +1,95 @@
+// flock, usleep, clock_gettime, localtime_r and st_mtim are POSIX/BSD, not
+// ISO C: ask for them so a strict -std=c99/c11 build still sees them.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #ifdef _WIN32
 #include <windows.h>
+#include <psapi.h>
+#include <io.h>
+#include <process.h>
 #define sleep_ms(ms) Sleep(ms)
+#define getpid _getpid
+#define fsync _commit
 #else
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
 static void sleep_ms(int ms) { usleep(ms * 1000); }
 #endif
 
 #define TERM_WIDTH 80
 #define CONTAINER_WIDTH 70  // Reduced width for the container
 #define USERS_CSV "users.csv"
-#define MAX_TXNS 2000
-#define MAX_CATS 60
+#define TXN_PAGE_SHIFT 10
+#define TXN_PAGE_SIZE (1 << TXN_PAGE_SHIFT)
+#define TXN_PAGE_MASK (TXN_PAGE_SIZE - 1)
+#define TXN_INCOME 0
+#define TXN_EXPENSE 1
+#define MAX_CATS 65535  // category ids are stored as uint16
+#define DEFAULT_CAT_COUNT 10
+#define CAT_SALARY 0       // defaults are interned first, so Salary is always id 0
 #define MAX_LINE 1024
 #define XOR_KEY 0x5A
+#define JOURNAL_COMPACT_MIN 256
+#define USERS_COMPACT_MIN 64
+#define TXN_WARN_OVER_INCOME 1
+#define TXN_WARN_OVER_BUDGET 2
+#define IMPORT_ALLOW_OVER_INCOME 1  // accept expenses above the month's income instead of rejecting them
+#define IMPORT_NO_JOURNAL 2         // caller persists with a snapshot instead
+#define AGG_MIN_YEAR 1900
+#define AGG_MAX_YEAR 9999
+#define FLOW_MONTHS ((AGG_MAX_YEAR - AGG_MIN_YEAR + 1) * 12)
+#define FLOW_DAYS (12 * 31)     // day buckets of a year: (month - 1) * 31 + day - 1
+#define LEDGER_MAGIC "PFLEDGER"
+#define LEDGER_VERSION 1
+#define MANIFEST_MAGIC "PFLEDMAN"
+#define MANIFEST_VERSION 1
+#define PART_LOADED 1   // the year's rows are in memory (or it has none on disk)
+#define PART_DIRTY 2    // changed since its partition file was written
+#define PART_BROKEN 4   // its partition file failed validation; never overwritten
+#define PART_ROLLUP 8   // rows still on disk, totals taken from the rollup file
+#define ROLLUP_MAGIC "PFROLLUP"
+#define ROLLUP_VERSION 2
+#define CSV_BLOCK (1 << 20)
+#define REPORT_BUF (1 << 20)
+#define SERVE_THREADS 4
+#define SERVE_QUEUE 64
+#define SERVE_MAX_ARGS 32
+#define REPORT_TXT 0
+#define REPORT_CSV 1
+#define REPORT_JSONL 2
+#define LIST_PAGE_ROWS 15
+#define STAT_BUCKETS 40  // latency histogram: bucket b counts calls taking [2^b, 2^(b+1)) ns
 
 #define C_RESET  "\033[0m"
 #define C_BOLD   "\033[1m"
@@ -34,45 +105,387 @@ static void sleep_ms(int ms) { usleep(ms * 1000); }
 
 typedef struct {
     int day, month, year;
-    char type[12];      
-    char category[64];
-    double amount;
+    int type;           // TXN_INCOME / TXN_EXPENSE
+    int cat;            // id in the category dictionary
+    int64_t amount;     // paise; every amount in the ledger is an exact integer
     char note[192];
     int id;
 } Transaction;
 
-static char cur_user[64] = "";
-static Transaction txns[MAX_TXNS];
-static int txn_count = 0;
-static char cats[MAX_CATS][64];
-static int cat_count = 0;
-static double monthly_budget = 0.0;
+typedef struct {
+    char name[64];
+    int kind;           // TXN_INCOME / TXN_EXPENSE
+} Category;
+
+typedef struct {
+    char name[64];
+    char pass[128];     // XOR-encoded, exactly as stored in users.csv
+} UserRec;
 
-static void print_border_line(int is_top) {
-    int pad = (TERM_WIDTH - CONTAINER_WIDTH) / 2;
-    printf("%*s%s", pad, "", C_B_BLUE);
-    if (is_top) {
-        printf("+");
-        for (int i = 0; i < CONTAINER_WIDTH - 2; i++) printf("-");
-        printf("+");
-    } else {
-        printf("+");
-        for (int i = 0; i < CONTAINER_WIDTH - 2; i++) printf("-");
-        printf("+");
+typedef struct {
+    char note[192];
+} TxnText;
+
+// The ledger is stored column-wise in fixed-size pages. Scans over dates,
+// types and amounts touch only the hot columns; the text lives in a separate
+// allocation and is only read for rows that are displayed or written out.
+typedef struct {
+    int id[TXN_PAGE_SIZE];              // 0 marks a deleted slot awaiting compaction
+    int date[TXN_PAGE_SIZE];            // packed yyyymmdd
+    unsigned char type[TXN_PAGE_SIZE];  // TXN_INCOME / TXN_EXPENSE
+    unsigned short cat[TXN_PAGE_SIZE];
+    int64_t amount[TXN_PAGE_SIZE];      // paise
+    TxnText *text;
+} TxnPage;
+
+// On-disk ledger snapshot (native byte order). Every section starts on an
+// 8-byte boundary so the columns can be used straight out of the mapping.
+typedef struct {
+    char magic[8];
+    uint32_t version, count;
+    int32_t next_id;
+    uint32_t cat_count;
+    uint64_t off_ids, off_dates, off_types, off_cats, off_amounts;  // int32, uint32 yyyymmdd, uint8, uint16, int64 paise
+    uint64_t off_note_offs, off_notes;    // uint32[count + 1] into the note heap
+    uint64_t off_cat_offs, off_cat_names; // uint32[cat_count + 1] into the category name heap
+    uint64_t file_size;
+} LedgerFileHeader;
+
+// The ledger on disk is one snapshot file per calendar year (the format
+// above, holding only that year's rows) plus a manifest naming them. The
+// manifest is replaced last, so it always describes a complete set of files.
+typedef struct {
+    char magic[8];
+    uint32_t version, part_count;
+    int32_t next_id;
+    uint32_t generation;        // bumped by every save; the rollup file records the one it matches
+} ManifestHeader;
+
+typedef struct {
+    int32_t year;
+    uint32_t count;
+    int32_t min_id, max_id;     // lets an ID lookup find the partition holding it
+} PartEntry;
+
+// Block-buffered line reader; lines are handed out in place, never copied.
+typedef struct {
+    FILE *f;
+    char *buf;
+    size_t len, pos;
+    long line_no;
+    int eof;
+} CsvReader;
+
+typedef struct {
+    int64_t income, expense;    // paise
+    int income_count, expense_count, salary_count;
+} MonthAgg;
+
+typedef struct {
+    int64_t income, expense;    // paise
+    int count;
+} CatCell;
+
+// One year of per-category totals, cells[cat * 12 + month - 1]; grows with the dictionary.
+typedef struct {
+    int cap;
+    CatCell *cells;
+} CatYear;
+
+// Identity of an on-disk file, to notice when another process replaced it.
+typedef struct {
+    int64_t ino, size, mtime;
+} FileSig;
+
+// Month and category totals of every partition as of one manifest, in
+// user_<name>_rollup.bin: the header, cat_count Category records, then
+// year_count RollupYear and cell_count RollupCell records (native byte order).
+// The generation alone can repeat (a restored or hand-edited manifest), so the
+// manifest file's signature has to match too.
+typedef struct {
+    char magic[8];
+    uint32_t version, generation;
+    uint32_t cat_count, year_count, cell_count, reserved;
+    FileSig manifest;
+} RollupHeader;
+
+typedef struct {
+    int32_t year, reserved;
+    MonthAgg months[12];
+} RollupYear;
+
+typedef struct {
+    int32_t year;
+    uint16_t cat;
+    uint8_t month, reserved;
+    CatCell cell;
+} RollupCell;
+
+typedef struct {
+    int date_lo, date_hi;   // packed yyyymmdd, inclusive
+    int type;               // TXN_INCOME, TXN_EXPENSE or -1 for both
+    const int *cat_sel;     // cat_sel[cat] != 0 selects the category; NULL selects all
+} RangeQuery;
+
+typedef struct {
+    int64_t sum, min, max;      // paise
+    long count;
+} RangeStats;
+
+// Posting list of one note trigram: slots in ascending order.
+typedef struct {
+    uint32_t key;           // three lowercased bytes, 0 = empty table entry
+    int len, cap;
+    int *slots;
+} TrigramList;
+
+// Everything that belongs to one signed-in user. The interactive and CLI
+// modes use main_ledger; the daemon keeps one per resident user and points
+// lg at it for the duration of a request.
+typedef struct {
+    char user[64];
+    TxnPage **txn_pages;            // records never move when the store grows
+    int txn_page_count, txn_page_cap;
+    int txn_slots;                  // slots in use, including deleted ones
+    int txn_count;                  // live transactions
+    int *id_index;                  // open addressing: id -> slot+1, 0 = empty, -1 = deleted
+    int id_index_cap, id_index_used;
+    int next_id;
+    int *date_index;                // live slots ordered by (date, slot); rebuilt lazily after bulk loads
+    int date_index_len, date_index_cap, date_index_ok;
+    TrigramList *text_index;        // open addressing on the trigram; may hold stale slots, see text_search
+    int text_index_cap, text_index_used, text_index_ok;
+    Category *cats;
+    int cat_count, cat_cap;
+    int *cat_index;                 // open addressing: name -> id+1, 0 = empty
+    int cat_index_cap;
+    int64_t monthly_budget;         // paise, 0 = none
+    MonthAgg *month_aggs[AGG_MAX_YEAR - AGG_MIN_YEAR + 1];  // 12-month block per year, allocated on first use
+    CatYear *cat_aggs[AGG_MAX_YEAR - AGG_MIN_YEAR + 1];     // likewise, per category
+    int64_t *flow_tree;             // Fenwick tree of net flow per month over all years, rebuilt from month_aggs when not ok
+    int flow_tree_ok;
+    int64_t *day_flow[AGG_MAX_YEAR - AGG_MIN_YEAR + 1];     // Fenwick tree of net flow per day, for loaded years that were asked about
+    FILE *journal_fp;
+    int journal_records;
+    long journal_pos;               // journal bytes already applied to this ledger
+    FileSig snap;                   // manifest this ledger was loaded from
+    PartEntry *parts;               // manifest entries in year order
+    int part_count, part_cap;
+    unsigned char part_flags[AGG_MAX_YEAR - AGG_MIN_YEAR + 1];  // PART_* by year
+    int legacy_snapshot;            // loaded from the old single-file layout; retired by the next save
+    uint32_t generation;            // of the manifest in lg->parts
+    int lock_fd, lock_depth;        // advisory lock on user_<name>.lock, held while depth > 0
+} Ledger;
+
+// Large user-space output buffer; rows are formatted straight into it and
+// handed to the OS in REPORT_BUF-sized writes.
+typedef struct {
+    FILE *f;
+    char *buf;
+    size_t len, cap;
+    int64_t written;
+    int err;
+} OutBuf;
+
+// Rows staged for ledger_insert_batch. why[i] is NULL for accepted rows and
+// the rejection reason otherwise; line_no[i] is the source line for messages.
+typedef struct {
+    Transaction *rows;
+    long *line_no;
+    const char **why;
+    int count, cap;
+    int accepted, over_budget;
+} TxnBatch;
+
+typedef struct {
+    int ym;             // yyyymm
+    int64_t income, expense;  // paise
+    long count;
+} MonthTotal;
+
+typedef struct {
+    int cat;
+    long count;
+    int64_t income, expense;  // paise
+} CatTotal;
+
+typedef struct {
+    long rows;
+    int64_t income, expense;  // paise
+} ReportTotals;
+
+static Ledger main_ledger = { .next_id = 1, .lock_fd = -1 };
+static THREAD_LOCAL Ledger *lg = &main_ledger;  // the ledger this thread is working on
+static UserRec *users = NULL;
+static int user_count = 0, user_cap = 0;
+static int *user_index = NULL;  // open addressing: name -> record+1, 0 = empty
+static int user_index_cap = 0;
+static long users_tail = 0;     // bytes of users.csv already folded into the directory
+static int64_t users_ino = -1;  // which users.csv those bytes came from
+static int users_superseded = 0;  // older password lines shadowed by a later one
+static THREAD_LOCAL int load_bad_lines = 0;
+static THREAD_LOCAL long scan_line_no = 0;   // source line of the row currently handed to a scan callback
+static THREAD_LOCAL char load_warning[160] = "";
+
+// ---- Instrumentation --------------------------------------------------------
+// Process-wide counters; the daemon's workers all feed the same ones, so every
+// update is atomic. Timed operations keep a log2 latency histogram; files are
+// tracked by kind (a process normally serves one user, or a few in the daemon).
+
+enum { OP_LOAD, OP_PART_LOAD, OP_ROLLUP, OP_SAVE, OP_JOURNAL, OP_SYNC, OP_AGGREGATE, OP_BALANCE, OP_SEARCH, OP_TEXT_INDEX, OP_TEXT_SEARCH, OP_EXPORT, OP_IMPORT, OP_LOGIN, OP_COUNT };
+enum { IO_SNAPSHOT, IO_ROLLUP, IO_JOURNAL, IO_USERS, IO_CATEGORIES, IO_SETTINGS, IO_IMPORT, IO_EXPORT, IO_COUNT };
+
+typedef struct {
+    uint64_t calls, total_ns, max_ns;
+    uint64_t hist[STAT_BUCKETS];
+} OpStat;
+
+typedef struct {
+    uint64_t reads, bytes_read, writes, bytes_written;
+} IoStat;
+
+static OpStat op_stats[OP_COUNT];
+static IoStat io_stats[IO_COUNT];
+static time_t stats_reset_at = 0;  // 0 = counting since the process started
+static const char *const op_names[OP_COUNT] = {
+    "load", "partition load", "rollup rebuild", "save snapshot", "journal append", "catch-up", "aggregate", "balance", "date search", "text index", "text search", "export", "import", "login"
+};
+static const char *const io_names[IO_COUNT] = {
+    "snapshot .bin", "rollup .bin", "journal", "users.csv", "categories", "settings", "csv import", "reports/exports"
+};
+
+#ifdef __GNUC__
+#define STAT_ADD(x, v) __atomic_fetch_add(&(x), (uint64_t)(v), __ATOMIC_RELAXED)
+#define STAT_GET(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STAT_SET(x, v) __atomic_store_n(&(x), (uint64_t)(v), __ATOMIC_RELAXED)
+#else
+#define STAT_ADD(x, v) ((x) += (uint64_t)(v))  // no daemon, so no concurrent updates
+#define STAT_GET(x) (x)
+#define STAT_SET(x, v) ((x) = (uint64_t)(v))
+#endif
+
+static int64_t now_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER f, c; QueryPerformanceFrequency(&f); QueryPerformanceCounter(&c);
+    return (int64_t)(c.QuadPart / f.QuadPart) * 1000000000 + (int64_t)(c.QuadPart % f.QuadPart) * 1000000000 / f.QuadPart;
+#else
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static void stat_max(uint64_t *m, uint64_t v) {
+#ifdef __GNUC__
+    uint64_t cur = __atomic_load_n(m, __ATOMIC_RELAXED);
+    while (v > cur && !__atomic_compare_exchange_n(m, &cur, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+#else
+    if (v > *m) *m = v;
+#endif
+}
+
+// Records one call of op that started at t0 (a now_ns() reading).
+static void stat_time(int op, int64_t t0) {
+    uint64_t ns = (uint64_t)(now_ns() - t0);
+    int b = 0;
+    for (uint64_t v = ns >> 1; v && b < STAT_BUCKETS - 1; v >>= 1) b++;
+    OpStat *s = &op_stats[op];
+    STAT_ADD(s->calls, 1); STAT_ADD(s->total_ns, ns); STAT_ADD(s->hist[b], 1);
+    stat_max(&s->max_ns, ns);
+}
+
+static int64_t file_size_of(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (int64_t)st.st_size : 0;
+}
+
+static void stat_io(int io, int64_t bytes_read, int64_t bytes_written) {
+    IoStat *s = &io_stats[io];
+    if (bytes_read > 0) { STAT_ADD(s->reads, 1); STAT_ADD(s->bytes_read, bytes_read); }
+    if (bytes_written > 0) { STAT_ADD(s->writes, 1); STAT_ADD(s->bytes_written, bytes_written); }
+}
+
+// ---- Screen ------------------------------------------------------------------
+// The print_* helpers compose the whole screen in memory; it reaches the
+// terminal in one write when the program is about to wait (for input, or
+// between animation frames) and at exit.
+typedef struct {
+    char *buf;
+    size_t len, cap;
+} Screen;
+
+static Screen scr;
+
+static void scr_flush(void) {
+    if (!scr.len) return;
+#ifdef _WIN32
+    fwrite(scr.buf, 1, scr.len, stdout);
+    fflush(stdout);
+#else
+    fflush(stdout);  // anything printed around the frame goes out first
+    for (size_t off = 0; off < scr.len; ) {
+        ssize_t n = write(STDOUT_FILENO, scr.buf + off, scr.len - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        off += (size_t)n;
+    }
+#endif
+    scr.len = 0;
+}
+
+static int scr_reserve(size_t n) {
+    if (scr.len + n <= scr.cap) return 1;
+    size_t cap = scr.cap ? scr.cap : 16384;
+    while (cap < scr.len + n) cap *= 2;
+    char *nb = realloc(scr.buf, cap);
+    if (!nb) { scr_flush(); return n <= scr.cap; }
+    scr.buf = nb; scr.cap = cap;
+    return 1;
+}
+
+static void scr_put(const char *p, size_t n) {
+    if (!scr_reserve(n)) { fwrite(p, 1, n, stdout); return; }
+    memcpy(scr.buf + scr.len, p, n); scr.len += n;
+}
+
+static void scr_puts(const char *s) { scr_put(s, strlen(s)); }
+
+static void scr_fill(char c, int n) {
+    if (n <= 0 || !scr_reserve((size_t)n)) return;
+    memset(scr.buf + scr.len, c, (size_t)n); scr.len += (size_t)n;
+}
+
+static void scr_printf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = scr_reserve(256) ? vsnprintf(scr.buf + scr.len, scr.cap - scr.len, fmt, ap) : -1;
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n >= scr.cap - scr.len) {  // did not fit: grow and format again
+        if (!scr_reserve((size_t)n + 1)) return;
+        va_start(ap, fmt);
+        vsnprintf(scr.buf + scr.len, scr.cap - scr.len, fmt, ap);
+        va_end(ap);
     }
-    printf("%s\n", C_RESET);
+    scr.len += (size_t)n;
+}
+
+static void print_border_line(int is_top) {
+    (void)is_top;  // top and bottom borders are drawn the same
+    scr_printf("%*s%s+", (TERM_WIDTH - CONTAINER_WIDTH) / 2, "", C_B_BLUE);
+    scr_fill('-', CONTAINER_WIDTH - 2);
+    scr_puts("+" C_RESET "\n");
 }
 
 static void print_side_borders(void) {
     int pad = (TERM_WIDTH - CONTAINER_WIDTH) / 2;
-    printf("%*s%s¦%*s¦%s\n", pad, "", C_B_BLUE, CONTAINER_WIDTH - 2, "", C_RESET);
+    scr_printf("%*s%s¦%*s¦%s\n", pad, "", C_B_BLUE, CONTAINER_WIDTH - 2, "", C_RESET);
 }
 
 static void print_centered_in_container(const char *s, const char *color) {
     int pad = (TERM_WIDTH - CONTAINER_WIDTH) / 2;
     int text_pad = (CONTAINER_WIDTH - (int)strlen(s)) / 2;
     if (text_pad < 0) text_pad = 0;
-    printf("%*s%s¦%*s%s%s%*s¦%s\n", 
+    scr_printf("%*s%s¦%*s%s%s%*s¦%s\n", 
            pad, "", C_B_BLUE, 
            text_pad, "", color, s, 
            CONTAINER_WIDTH - 2 - text_pad - (int)strlen(s), "", 
@@ -81,7 +494,7 @@ static void print_centered_in_container(const char *s, const char *color) {
 
 static void print_left_in_container(const char *s, const char *color) {
     int pad = (TERM_WIDTH - CONTAINER_WIDTH) / 2;
-    printf("%*s%s¦ %s%s%*s¦%s\n", 
+    scr_printf("%*s%s¦ %s%s%*s¦%s\n", 
            pad, "", C_B_BLUE, 
            color, s, 
            CONTAINER_WIDTH - 3 - (int)strlen(s), "", 
@@ -90,18 +503,18 @@ static void print_left_in_container(const char *s, const char *color) {
 
 static void print_empty_line_in_container(void) {
     int pad = (TERM_WIDTH - CONTAINER_WIDTH) / 2;
-    printf("%*s%s¦%*s¦%s\n", pad, "", C_B_BLUE, CONTAINER_WIDTH - 2, "", C_RESET);
+    scr_printf("%*s%s¦%*s¦%s\n", pad, "", C_B_BLUE, CONTAINER_WIDTH - 2, "", C_RESET);
 }
 
 static void print_separator_in_container(void) {
-    int pad = (TERM_WIDTH - CONTAINER_WIDTH) / 2;
-    printf("%*s%s¦", pad, "", C_B_BLUE);
-    for (int i = 0; i < CONTAINER_WIDTH - 2; i++) printf("-");
-    printf("¦%s\n", C_RESET);
+    scr_printf("%*s%s¦", (TERM_WIDTH - CONTAINER_WIDTH) / 2, "", C_B_BLUE);
+    scr_fill('-', CONTAINER_WIDTH - 2);
+    scr_puts("¦" C_RESET "\n");
 }
 
 static void print_header(const char *title) {
-    system("clear || cls");
+    scr.len = 0;                       // nothing of the previous screen survives the clear
+    scr_puts("\033[H\033[2J\033[3J");  // home, clear, drop scrollback: what `clear` sends
     print_border_line(1);  // Top border
     print_empty_line_in_container();
     print_centered_in_container("==============================================", C_MAGENTA);
@@ -117,6 +530,7 @@ static void print_footer(void) {
 
 static void wait_enter_center(void) {
     print_centered_in_container("(Press Enter to continue)", C_CYAN);
+    scr_flush();
     if (getchar() != '\n') while (getchar() != '\n');
 }
 
@@ -130,9 +544,8 @@ static void print_success(const char* msg) {
 
 static void get_input(const char *prompt, char *out, int sz) {
     int pad = (TERM_WIDTH - CONTAINER_WIDTH) / 2;
-    printf("%*s%s¦ %s: ", pad, "", C_B_BLUE, prompt);
-    printf("%s", C_RESET);
-    fflush(stdout);
+    scr_printf("%*s%s¦ %s: %s", pad, "", C_B_BLUE, prompt, C_RESET);
+    scr_flush();
     if (!fgets(out, sz, stdin)) { out[0] = '\0'; return; }
     out[strcspn(out, "\n")] = 0;
 }
@@ -141,203 +554,2718 @@ static void xor_str(char *s) {
     for (int i = 0; s[i]; ++i) s[i] ^= XOR_KEY;
 }
 
-static int next_txn_id(void) {
-    int m = 0;
-    for (int i = 0; i < txn_count; ++i) if (txns[i].id > m) m = txns[i].id;
-    return m + 1;
+static const char *txn_type_name(int type) { return type == TXN_INCOME ? "Income" : "Expense"; }
+
+static const char *cat_name(int id) { return lg->cats[id].name; }
+
+static unsigned name_hash(const char *p, size_t n) {
+    unsigned h = 2166136261u;
+    while (n--) h = (h ^ (unsigned char)*p++) * 16777619u;
+    return h;
 }
 
-static void txns_path(const char *user, char *out, int sz) {
-    snprintf(out, sz, "user_%s_txns.csv", user);
+static int cat_find(const char *p, size_t n) {
+    if (!lg->cat_index_cap) return -1;
+    unsigned mask = lg->cat_index_cap - 1;
+    for (unsigned h = name_hash(p, n) & mask; lg->cat_index[h]; h = (h + 1) & mask) {
+        const char *name = lg->cats[lg->cat_index[h] - 1].name;
+        if (strncmp(name, p, n) == 0 && name[n] == '\0') return lg->cat_index[h] - 1;
+    }
+    return -1;
 }
 
-static void settings_path(const char *user, char *out, int sz) {
-    snprintf(out, sz, "user_%s_settings.txt", user);
+static int cat_index_rebuild(int cap) {
+    int *ni = calloc(cap, sizeof(int));
+    if (!ni) return 0;
+    free(lg->cat_index); lg->cat_index = ni; lg->cat_index_cap = cap;
+    for (int i = 0; i < lg->cat_count; ++i) {
+        unsigned h = name_hash(lg->cats[i].name, strlen(lg->cats[i].name)) & (cap - 1);
+        while (lg->cat_index[h]) h = (h + 1) & (cap - 1);
+        lg->cat_index[h] = i + 1;
+    }
+    return 1;
 }
 
-static int is_valid_date(const char *d) {
-    int dd, mm, yy;
-    if (sscanf(d, "%d/%d/%d", &dd, &mm, &yy) != 3) return 0;
-    if (mm < 1 || mm > 12) return 0;
-    if (dd < 1 || dd > 31) return 0;
-    if (yy < 1900 || yy > 9999) return 0;
+// Returns the id for name[0..n), adding it with the given kind if it is new; -1 if full.
+static int cat_intern(const char *p, size_t n, int kind) {
+    char name[64];
+    if (n >= sizeof(name)) n = sizeof(name) - 1;
+    memcpy(name, p, n); name[n] = '\0';
+    for (size_t i = 0; i < n; ++i) if (name[i] == ',') name[i] = ';';  // stays a single CSV field
+    int id = cat_find(name, n);
+    if (id >= 0) return id;
+    if (lg->cat_count >= MAX_CATS) return -1;
+    if (lg->cat_count == lg->cat_cap) {
+        int ncap = lg->cat_cap ? lg->cat_cap * 2 : 32;
+        Category *nc = realloc(lg->cats, ncap * sizeof(*nc));
+        if (!nc) return -1;
+        lg->cats = nc; lg->cat_cap = ncap;
+    }
+    if ((lg->cat_count + 1) * 2 > lg->cat_index_cap && !cat_index_rebuild(lg->cat_index_cap ? lg->cat_index_cap * 2 : 64)) return -1;
+    id = lg->cat_count++;
+    memcpy(lg->cats[id].name, name, n + 1);
+    lg->cats[id].kind = kind;
+    unsigned mask = lg->cat_index_cap - 1, h = name_hash(name, n) & mask;
+    while (lg->cat_index[h]) h = (h + 1) & mask;
+    lg->cat_index[h] = id + 1;
+    return id;
+}
+
+static uint32_t pack_date(int d, int m, int y) { return (uint32_t)(y * 10000 + m * 100 + d); }
+
+static TxnPage* txn_page(int slot) { return lg->txn_pages[slot >> TXN_PAGE_SHIFT]; }
+
+static int txn_id(int slot) { return txn_page(slot)->id[slot & TXN_PAGE_MASK]; }
+
+// Rows in page p that are actually in use.
+static int txn_page_rows(int p) {
+    int n = lg->txn_slots - (p << TXN_PAGE_SHIFT);
+    return n > TXN_PAGE_SIZE ? TXN_PAGE_SIZE : n;
+}
+
+static void txn_store(int slot, const Transaction *t) {
+    TxnPage *pg = txn_page(slot);
+    int i = slot & TXN_PAGE_MASK;
+    pg->id[i] = t->id;
+    pg->date[i] = (int)pack_date(t->day, t->month, t->year);
+    pg->type[i] = (unsigned char)t->type;
+    pg->cat[i] = (unsigned short)t->cat;
+    pg->amount[i] = t->amount;
+    memcpy(pg->text[i].note, t->note, sizeof(pg->text[i].note));
+}
+
+static void txn_load(int slot, Transaction *t) {
+    TxnPage *pg = txn_page(slot);
+    int i = slot & TXN_PAGE_MASK, d = pg->date[i];
+    t->id = pg->id[i];
+    t->year = d / 10000; t->month = d / 100 % 100; t->day = d % 100;
+    t->type = pg->type[i];
+    t->cat = pg->cat[i];
+    t->amount = pg->amount[i];
+    memcpy(t->note, pg->text[i].note, sizeof(t->note));
+}
+
+static int txn_push(const Transaction *t) {
+    if (lg->txn_slots == lg->txn_page_count * TXN_PAGE_SIZE) {
+        if (lg->txn_page_count == lg->txn_page_cap) {
+            int ncap = lg->txn_page_cap ? lg->txn_page_cap * 2 : 16;
+            TxnPage **np = realloc(lg->txn_pages, ncap * sizeof(*np));
+            if (!np) return -1;
+            lg->txn_pages = np; lg->txn_page_cap = ncap;
+        }
+        TxnPage *pg = malloc(sizeof(TxnPage));
+        if (!pg) return -1;
+        if (!(pg->text = malloc(TXN_PAGE_SIZE * sizeof(TxnText)))) { free(pg); return -1; }
+        lg->txn_pages[lg->txn_page_count++] = pg;
+    }
+    int slot = lg->txn_slots++;
+    txn_store(slot, t);
+    lg->txn_count++;
+    return slot;
+}
+
+static unsigned id_hash(int id) { return (unsigned)id * 2654435761u; }
+
+static int id_index_find(int id) {
+    if (!lg->id_index_cap) return -1;
+    unsigned mask = lg->id_index_cap - 1;
+    for (unsigned h = id_hash(id) & mask; lg->id_index[h]; h = (h + 1) & mask)
+        if (lg->id_index[h] > 0 && txn_id(lg->id_index[h] - 1) == id) return (int)h;
+    return -1;
+}
+
+// Replaces the index with ni (cap zeroed entries) filled from the live slots.
+static void id_index_fill(int *ni, int cap) {
+    free(lg->id_index); lg->id_index = ni; lg->id_index_cap = cap; lg->id_index_used = 0;
+    for (int i = 0; i < lg->txn_slots; ++i) {
+        int id = txn_id(i);
+        if (!id) continue;
+        unsigned h = id_hash(id) & (cap - 1);
+        while (lg->id_index[h]) h = (h + 1) & (cap - 1);
+        lg->id_index[h] = i + 1; lg->id_index_used++;
+    }
+}
+
+static int id_index_rebuild(int cap) {
+    int *ni = calloc(cap, sizeof(int));
+    if (!ni) return 0;
+    id_index_fill(ni, cap);
     return 1;
 }
 
-static void load_default_categories(void) {
-    const char *d[] = {"Salary","Business","Other Income","Grocery","Utilities","Transport","Dining & Food","Shopping","Healthcare","Others"};
-    cat_count = 0;
-    for (size_t i = 0; i < sizeof(d)/sizeof(d[0]) && cat_count < MAX_CATS; ++i) {
-        strncpy(cats[cat_count++], d[i], sizeof(cats[0])-1);
-        cats[cat_count-1][sizeof(cats[0])-1] = '\0';
+static void id_index_put(int id, int slot) {
+    int pos = id_index_find(id);
+    if (pos >= 0) { lg->id_index[pos] = slot + 1; return; }
+    if ((lg->id_index_used + 1) * 2 > lg->id_index_cap) {
+        int cap = lg->id_index_cap ? lg->id_index_cap : 1024;
+        while ((lg->txn_count + 1) * 2 > cap) cap *= 2;  // rehash drops deleted markers, so may not need to grow
+        if (!id_index_rebuild(cap)) return;
+        if (id_index_find(id) >= 0) return;  // rebuild already picked up the new slot
     }
+    unsigned mask = lg->id_index_cap - 1, h = id_hash(id) & mask;
+    while (lg->id_index[h] > 0) h = (h + 1) & mask;
+    if (!lg->id_index[h]) lg->id_index_used++;
+    lg->id_index[h] = slot + 1;
 }
 
-static void add_category_session(const char *name) {
-    if (cat_count < MAX_CATS) {
-        strncpy(cats[cat_count++], name, sizeof(cats[0])-1);
-        cats[cat_count-1][sizeof(cats[0])-1] = '\0';
+static int txn_date(int slot) { return txn_page(slot)->date[slot & TXN_PAGE_MASK]; }
+
+// First index position whose (date, slot) is not below the given key.
+static int date_index_lower(int date, int slot) {
+    int lo = 0, hi = lg->date_index_len;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1, s = lg->date_index[mid], d = txn_date(s);
+        if (d < date || (d == date && s < slot)) lo = mid + 1; else hi = mid;
     }
+    return lo;
 }
 
-static void welcome_animation(const char *username_display) {
-    print_header("Personal Budget Tracker");
-    if (username_display && username_display[0]) {
-        char hello[128]; snprintf(hello, sizeof(hello), "Hello, %s", username_display);
-        print_centered_in_container(hello, C_CYAN);
-    } else {
-        print_centered_in_container("Hello, User", C_CYAN);
+static int date_index_cmp(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b, dx = txn_date(x), dy = txn_date(y);
+    if (dx != dy) return dx < dy ? -1 : 1;
+    return (x > y) - (x < y);
+}
+
+static int date_index_ensure(void) {
+    if (lg->date_index_ok) return 1;
+    if (lg->date_index_cap < lg->txn_count) {
+        int *ni = realloc(lg->date_index, (lg->txn_count + 1024) * sizeof(int));
+        if (!ni) return 0;
+        lg->date_index = ni; lg->date_index_cap = lg->txn_count + 1024;
     }
+    lg->date_index_len = 0;
+    for (int i = 0; i < lg->txn_slots; ++i) if (txn_id(i)) lg->date_index[lg->date_index_len++] = i;
+    qsort(lg->date_index, lg->date_index_len, sizeof(int), date_index_cmp);
+    lg->date_index_ok = 1;
+    return 1;
+}
 
-  print_empty_line_in_container();
-    int bar_width = 40;
-    int pad = (TERM_WIDTH - CONTAINER_WIDTH) / 2;
-    printf("%*s%s¦", pad, "", C_B_BLUE);
-    for (int i = 0; i <= bar_width; ++i) {
-        printf("\r%*s%s¦%*s%s[", pad, "", C_B_BLUE, (CONTAINER_WIDTH - bar_width - 4) / 2, "", C_CYAN);
-        for (int j = 0; j < i; ++j) printf("#");
-        for (int j = i; j < bar_width; ++j) printf("-");
-        printf("]%s", C_RESET);
-        fflush(stdout);
-        sleep_ms(30);
+// Incremental maintenance only while the index is valid; otherwise the next query rebuilds it.
+static void date_index_add(int slot) {
+    if (!lg->date_index_ok) return;
+    if (lg->date_index_len == lg->date_index_cap) {
+        int ncap = lg->date_index_cap ? lg->date_index_cap * 2 : 1024;
+        int *ni = realloc(lg->date_index, ncap * sizeof(int));
+        if (!ni) { lg->date_index_ok = 0; return; }
+        lg->date_index = ni; lg->date_index_cap = ncap;
     }
-    printf("%*s%s¦%s\n", CONTAINER_WIDTH - bar_width - 6, "", C_B_BLUE, C_RESET);
-    sleep_ms(150);
-    print_footer();
+    int pos = date_index_lower(txn_date(slot), slot);
+    memmove(&lg->date_index[pos + 1], &lg->date_index[pos], (lg->date_index_len - pos) * sizeof(int));
+    lg->date_index[pos] = slot;
+    lg->date_index_len++;
 }
 
-static int verify_user_file(const char *username, const char *password) {
-    FILE *f = fopen(USERS_CSV, "r");
-    if (!f) return 0;
-    char line[MAX_LINE];
-    int ok = 0;
-    while (fgets(line, sizeof(line), f)) {
-        char u[64], penc[128];
-        if (sscanf(line, "%63[^,],%127[^\n]", u, penc) == 2) {
-            if (strcmp(u, username) == 0) {
-                char dec[128]; strncpy(dec, penc, sizeof(dec)-1); dec[sizeof(dec)-1]='\0'; xor_str(dec);
-                if (strcmp(dec, password) == 0) ok = 1;
-                break;
+// Must run while the slot still holds the date it was indexed under.
+static void date_index_remove(int slot) {
+    if (!lg->date_index_ok) return;
+    int pos = date_index_lower(txn_date(slot), slot);
+    if (pos >= lg->date_index_len || lg->date_index[pos] != slot) { lg->date_index_ok = 0; return; }
+    memmove(&lg->date_index[pos], &lg->date_index[pos + 1], (lg->date_index_len - pos - 1) * sizeof(int));
+    lg->date_index_len--;
+}
+
+// Index positions [*first, return value) hold the live slots dated lo..hi in date order.
+static void ledger_need_years(int lo, int hi);
+
+static int date_index_range(int lo, int hi, int *first) {
+    ledger_need_years(lo / 10000, hi / 10000);
+    int64_t t0 = now_ns();
+    int end = 0;
+    if (!date_index_ensure()) *first = 0;
+    else { *first = date_index_lower(lo, 0); end = date_index_lower(hi + 1, 0); }
+    stat_time(OP_SEARCH, t0);
+    return end;
+}
+
+// Trigram index over notes: each three-byte window of a lowercased note
+// lists the slots whose note contains it. Lists only ever grow between
+// rebuilds; deleted rows and the old text of edited rows stay behind as stale
+// entries, and text_search checks every candidate against the real row.
+static int interactive_session = 0;  // the menus: index (and load this year) at login instead of on first use
+
+static uint32_t trigram_key(const char *p) {
+    return (uint32_t)tolower((unsigned char)p[0]) << 16 | (uint32_t)tolower((unsigned char)p[1]) << 8
+         | (uint32_t)tolower((unsigned char)p[2]);
+}
+
+static TrigramList *trigram_find(uint32_t key) {
+    if (!lg->text_index_cap) return NULL;
+    unsigned mask = lg->text_index_cap - 1, h = (key * 2654435761u) & mask;
+    while (lg->text_index[h].key && lg->text_index[h].key != key) h = (h + 1) & mask;
+    return lg->text_index[h].key ? &lg->text_index[h] : NULL;
+}
+
+static TrigramList *trigram_get(uint32_t key) {
+    if ((lg->text_index_used + 1) * 2 > lg->text_index_cap) {
+        int cap = lg->text_index_cap ? lg->text_index_cap * 2 : 4096;
+        TrigramList *nt = calloc(cap, sizeof(*nt));
+        if (!nt) return NULL;
+        for (int i = 0; i < lg->text_index_cap; ++i) {
+            if (!lg->text_index[i].key) continue;
+            unsigned h = (lg->text_index[i].key * 2654435761u) & (cap - 1);
+            while (nt[h].key) h = (h + 1) & (cap - 1);
+            nt[h] = lg->text_index[i];
+        }
+        free(lg->text_index);
+        lg->text_index = nt; lg->text_index_cap = cap;
+    }
+    unsigned mask = lg->text_index_cap - 1, h = (key * 2654435761u) & mask;
+    while (lg->text_index[h].key && lg->text_index[h].key != key) h = (h + 1) & mask;
+    if (!lg->text_index[h].key) { lg->text_index[h].key = key; lg->text_index_used++; }
+    return &lg->text_index[h];
+}
+
+static int trigram_add(TrigramList *l, int slot) {
+    int pos = l->len;
+    if (pos && l->slots[pos - 1] >= slot) {  // an edited row; new rows always land at the end
+        int lo = 0, hi = l->len;
+        while (lo < hi) { int mid = (lo + hi) >> 1; if (l->slots[mid] < slot) lo = mid + 1; else hi = mid; }
+        if (lo < l->len && l->slots[lo] == slot) return 1;
+        pos = lo;
+    }
+    if (l->len == l->cap) {
+        int ncap = l->cap ? l->cap * 2 : 4;
+        int *ns = realloc(l->slots, ncap * sizeof(int));
+        if (!ns) return 0;
+        l->slots = ns; l->cap = ncap;
+    }
+    memmove(&l->slots[pos + 1], &l->slots[pos], (l->len - pos) * sizeof(int));
+    l->slots[pos] = slot;
+    l->len++;
+    return 1;
+}
+
+static void text_index_add(int slot) {
+    if (!lg->text_index_ok) return;
+    const char *note = txn_page(slot)->text[slot & TXN_PAGE_MASK].note;
+    for (size_t i = 0, n = strlen(note); i + 3 <= n; ++i) {
+        TrigramList *l = trigram_get(trigram_key(note + i));
+        if (!l || !trigram_add(l, slot)) { lg->text_index_ok = 0; return; }
+    }
+}
+
+static int text_index_ensure(void) {
+    if (lg->text_index_ok) return 1;
+    int64_t t0 = now_ns();
+    for (int i = 0; i < lg->text_index_cap; ++i) lg->text_index[i].len = 0;
+    lg->text_index_ok = 1;
+    for (int i = 0; i < lg->txn_slots && lg->text_index_ok; ++i) if (txn_id(i)) text_index_add(i);
+    stat_time(OP_TEXT_INDEX, t0);
+    return lg->text_index_ok;
+}
+
+static void text_index_free(void) {
+    for (int i = 0; i < lg->text_index_cap; ++i) free(lg->text_index[i].slots);
+    free(lg->text_index);
+    lg->text_index = NULL; lg->text_index_cap = lg->text_index_used = lg->text_index_ok = 0;
+}
+
+static int contains_nocase(const char *hay, const char *needle, size_t n) {
+    for (; *hay; ++hay) {
+        size_t k = 0;
+        while (k < n && hay[k] && tolower((unsigned char)hay[k]) == (unsigned char)needle[k]) k++;
+        if (k == n) return 1;
+    }
+    return 0;
+}
+
+#define SEARCH_MAX_TERMS 8
+
+typedef struct {
+    char term[SEARCH_MAX_TERMS][64];    // lowercased
+    size_t len[SEARCH_MAX_TERMS];
+    int count;
+} TextQuery;
+
+static int text_query_parse(const char *s, TextQuery *q) {
+    q->count = 0;
+    while (*s && q->count < SEARCH_MAX_TERMS) {
+        while (*s == ' ' || *s == '\t') s++;
+        size_t n = 0;
+        while (s[n] && s[n] != ' ' && s[n] != '\t') n++;
+        if (!n) break;
+        if (n > sizeof(q->term[0]) - 1) n = sizeof(q->term[0]) - 1;
+        for (size_t i = 0; i < n; ++i) q->term[q->count][i] = (char)tolower((unsigned char)s[i]);
+        q->term[q->count][n] = '\0'; q->len[q->count++] = n;
+        while (*s && *s != ' ' && *s != '\t') s++;
+    }
+    return q->count;
+}
+
+// Every term must appear in the note or the category name.
+static int text_match(int slot, const TextQuery *q) {
+    const char *note = txn_page(slot)->text[slot & TXN_PAGE_MASK].note, *cat = cat_name(txn_page(slot)->cat[slot & TXN_PAGE_MASK]);
+    for (int t = 0; t < q->count; ++t)
+        if (!contains_nocase(note, q->term[t], q->len[t]) && !contains_nocase(cat, q->term[t], q->len[t])) return 0;
+    return 1;
+}
+
+static int slot_cmp(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Live slots matching every term of the query, ascending, in a malloc'd array
+// (*out, NULL when nothing matched). Candidates come from the most selective
+// term of three or more bytes: the intersection of its trigram lists plus the
+// rows of any category whose name contains it. Only when every term is
+// shorter than a trigram does this fall back to checking each row.
+static int text_search(const char *query, int **out) {
+    TextQuery q; *out = NULL;
+    if (!text_query_parse(query, &q)) return 0;
+    ledger_need_years(AGG_MIN_YEAR, AGG_MAX_YEAR);
+    int64_t t0 = now_ns();
+    int best = -1, best_len = INT32_MAX, indexed = text_index_ensure();
+    for (int t = 0; t < q.count && indexed; ++t) {
+        if (q.len[t] < 3) continue;
+        int shortest = 0;
+        for (size_t i = 0; i + 3 <= q.len[t]; ++i) {
+            TrigramList *l = trigram_find(trigram_key(q.term[t] + i));
+            int n = l ? l->len : 0;
+            if (!i || n < shortest) shortest = n;
+        }
+        if (shortest < best_len) { best = t; best_len = shortest; }
+    }
+    int *cand = NULL, n = 0;
+    if (best < 0) {
+        if (!(cand = malloc((lg->txn_slots + 1) * sizeof(int)))) return 0;
+        for (int i = 0; i < lg->txn_slots; ++i) cand[n++] = i;
+    } else {
+        const char *term = q.term[best]; size_t tl = q.len[best];
+        int cat_hits = 0;
+        char *cat_sel = calloc(lg->cat_count + 1, 1);
+        for (int c = 0; cat_sel && c < lg->cat_count; ++c) if (contains_nocase(lg->cats[c].name, term, tl)) cat_sel[c] = 1, cat_hits++;
+        TrigramList *base = NULL;
+        for (size_t i = 0; i + 3 <= tl; ++i) {
+            TrigramList *l = trigram_find(trigram_key(term + i));
+            if (!l || !l->len) { base = NULL; break; }
+            if (!base || l->len < base->len) base = l;
+        }
+        int cap = (base ? base->len : 0) + (cat_hits ? lg->txn_slots : 0) + 1;
+        if (!cat_sel || !(cand = malloc(cap * sizeof(int)))) { free(cat_sel); return 0; }
+        for (int k = 0; base && k < base->len; ++k) {
+            int s = base->slots[k], keep = 1;
+            for (size_t i = 0; i + 3 <= tl && keep; ++i) {
+                TrigramList *l = trigram_find(trigram_key(term + i));
+                if (l == base) continue;
+                int lo = 0, hi = l->len;
+                while (lo < hi) { int mid = (lo + hi) >> 1; if (l->slots[mid] < s) lo = mid + 1; else hi = mid; }
+                keep = lo < l->len && l->slots[lo] == s;
+            }
+            if (keep) cand[n++] = s;
+        }
+        if (cat_hits) {
+            int from_notes = n;
+            for (int p = 0; p < lg->txn_page_count; ++p) {
+                const TxnPage *pg = lg->txn_pages[p];
+                for (int i = 0, rows = txn_page_rows(p); i < rows; ++i) if (cat_sel[pg->cat[i]]) cand[n++] = p * TXN_PAGE_SIZE + i;
+            }
+            if (from_notes && n > from_notes) {  // both halves ascending; sort the union and drop repeats
+                qsort(cand, n, sizeof(int), slot_cmp);
+                int w = 0;
+                for (int k = 0; k < n; ++k) if (!w || cand[w - 1] != cand[k]) cand[w++] = cand[k];
+                n = w;
             }
         }
+        free(cat_sel);
     }
-    fclose(f);
-    return ok;
+    int w = 0;
+    for (int k = 0; k < n; ++k) if (txn_id(cand[k]) && text_match(cand[k], &q)) cand[w++] = cand[k];
+    if (w) *out = cand; else free(cand);
+    stat_time(OP_TEXT_SEARCH, t0);
+    return w;
+}
+
+// Squeeze out deleted slots. Moves records, so only called where no slot
+// numbers are held (snapshot compaction and load).
+// 0, with nothing moved, when the new ID index cannot be allocated.
+static int txn_compact_slots(void) {
+    if (lg->txn_slots == lg->txn_count) return 1;
+    int cap = lg->id_index_cap ? lg->id_index_cap : 1024;
+    int *ni = calloc(cap, sizeof(int));  // before the move: afterwards the old index is useless
+    if (!ni) return 0;
+    int w = 0;
+    for (int r = 0; r < lg->txn_slots; ++r) {
+        if (!txn_id(r)) continue;
+        if (w != r) {
+            TxnPage *src = txn_page(r), *dst = txn_page(w);
+            int i = r & TXN_PAGE_MASK, j = w & TXN_PAGE_MASK;
+            dst->id[j] = src->id[i]; dst->date[j] = src->date[i];
+            dst->type[j] = src->type[i]; dst->cat[j] = src->cat[i]; dst->amount[j] = src->amount[i];
+            dst->text[j] = src->text[i];
+        }
+        w++;
+    }
+    lg->txn_slots = w;
+    id_index_fill(ni, cap);
+    lg->date_index_ok = 0; lg->text_index_ok = 0;
+    return 1;
+}
+
+// Fenwick trees over n buckets: point update, and the sum of buckets [0, i).
+static void fenwick_add(int64_t *t, int n, int i, int64_t v) {
+    for (++i; i <= n; i += i & -i) t[i - 1] += v;
+}
+
+static int64_t fenwick_sum(const int64_t *t, int i) {
+    int64_t s = 0;
+    for (; i > 0; i -= i & -i) s += t[i - 1];
+    return s;
+}
+
+// Turns plain bucket values into the tree in place, in linear time.
+static void fenwick_build(int64_t *t, int n) {
+    for (int i = 1; i <= n; ++i) { int j = i + (i & -i); if (j <= n) t[j - 1] += t[i - 1]; }
+}
+
+// Day bucket of a date in its year's day tree. Parsing rejects impossible
+// dates, but a partition written before it did may still hold some; those are
+// clamped into range rather than trusted as an index.
+static int flow_day(int m, int d) {
+    if (m < 1) m = 1; else if (m > 12) m = 12;
+    if (d < 1) d = 1; else if (d > 31) d = 31;
+    return (m - 1) * 31 + d - 1;
+}
+
+static MonthAgg* month_agg(int m, int y, int create) {
+    if (m < 1 || m > 12 || y < AGG_MIN_YEAR || y > AGG_MAX_YEAR) return NULL;
+    MonthAgg **blk = &lg->month_aggs[y - AGG_MIN_YEAR];
+    if (!*blk && (!create || !(*blk = calloc(12, sizeof(MonthAgg))))) return NULL;
+    return &(*blk)[m - 1];
+}
+
+static CatCell *cat_cell(int m, int y, int cat, int create) {
+    if (m < 1 || m > 12 || y < AGG_MIN_YEAR || y > AGG_MAX_YEAR || cat < 0) return NULL;
+    CatYear **blk = &lg->cat_aggs[y - AGG_MIN_YEAR];
+    if (!*blk && (!create || !(*blk = calloc(1, sizeof(CatYear))))) return NULL;
+    if (cat >= (*blk)->cap) {
+        int ncap = cat + 16;
+        CatCell *nc;
+        if (!create || !(nc = realloc((*blk)->cells, (size_t)ncap * 12 * sizeof(CatCell)))) return NULL;
+        memset(nc + (size_t)(*blk)->cap * 12, 0, (size_t)(ncap - (*blk)->cap) * 12 * sizeof(CatCell));
+        (*blk)->cells = nc; (*blk)->cap = ncap;
+    }
+    return &(*blk)->cells[cat * 12 + m - 1];
+}
+
+static void agg_add(int m, int y, int type, int cat, int64_t amount, int sign) {
+    MonthAgg *a = month_agg(m, y, 1);
+    CatCell *c = cat_cell(m, y, cat, 1);
+    if (!a) return;
+    if (lg->flow_tree_ok) fenwick_add(lg->flow_tree, FLOW_MONTHS, (y - AGG_MIN_YEAR) * 12 + m - 1, type == TXN_INCOME ? sign * amount : -sign * amount);
+    if (type == TXN_INCOME) {
+        a->income += sign * amount;
+        a->income_count += sign;
+        if (cat == CAT_SALARY) a->salary_count += sign;
+        if (c) c->income += sign * amount;
+    } else {
+        a->expense += sign * amount;
+        a->expense_count += sign;
+        if (c) c->expense += sign * amount;
+    }
+    if (c) c->count += sign;
+}
+
+static void agg_apply(const Transaction *t, int sign) {
+    agg_add(t->month, t->year, t->type, t->cat, t->amount, sign);
+    int64_t *df = t->year >= AGG_MIN_YEAR && t->year <= AGG_MAX_YEAR ? lg->day_flow[t->year - AGG_MIN_YEAR] : NULL;
+    if (df) fenwick_add(df, FLOW_DAYS, flow_day(t->month, t->day), t->type == TXN_INCOME ? sign * t->amount : -sign * t->amount);
+}
+
+static void agg_reset_year(int i) {
+    if (lg->month_aggs[i]) memset(lg->month_aggs[i], 0, 12 * sizeof(MonthAgg));
+    if (lg->cat_aggs[i]) memset(lg->cat_aggs[i]->cells, 0, (size_t)lg->cat_aggs[i]->cap * 12 * sizeof(CatCell));
+    free(lg->day_flow[i]); lg->day_flow[i] = NULL;
+    lg->flow_tree_ok = 0;
+}
+
+static void agg_reset(void) {
+    for (int y = 0; y <= AGG_MAX_YEAR - AGG_MIN_YEAR; ++y) agg_reset_year(y);
+}
+
+// A year's rows are faulted in by the loaders further down; here it costs one flag test.
+// Totals only need the rows when the rollup file did not cover the year.
+static void part_fault(int lo, int hi);
+
+static void agg_need_year(int y) {
+    if (y >= AGG_MIN_YEAR && y <= AGG_MAX_YEAR && !(lg->part_flags[y - AGG_MIN_YEAR] & (PART_LOADED | PART_ROLLUP))) part_fault(y, y);
+}
+
+static void ledger_need_year(int y) {
+    if (y >= AGG_MIN_YEAR && y <= AGG_MAX_YEAR && !(lg->part_flags[y - AGG_MIN_YEAR] & PART_LOADED)) part_fault(y, y);
+}
+
+static void part_touch(int y) {
+    if (y >= AGG_MIN_YEAR && y <= AGG_MAX_YEAR) lg->part_flags[y - AGG_MIN_YEAR] |= PART_DIRTY;
+}
+
+static int64_t sum_income_month(int m, int y) {
+    agg_need_year(y);
+    MonthAgg *a = month_agg(m, y, 0);
+    return a ? a->income : 0;
+}
+
+static int64_t sum_expense_month(int m, int y) {
+    agg_need_year(y);
+    MonthAgg *a = month_agg(m, y, 0);
+    return a ? a->expense : 0;
+}
+
+static int salary_exists_in_month(int m, int y) {
+    agg_need_year(y);
+    MonthAgg *a = month_agg(m, y, 0);
+    return a && a->salary_count > 0;
+}
+
+// Month tree over the totals of every partition; years not in memory count
+// from the rollup, so building it reads no rows.
+static int flow_tree_ensure(void) {
+    if (lg->flow_tree_ok) return 1;
+    for (int i = 0; i < lg->part_count; ++i) agg_need_year(lg->parts[i].year);
+    if (!lg->flow_tree && !(lg->flow_tree = malloc(FLOW_MONTHS * sizeof(int64_t)))) return 0;
+    memset(lg->flow_tree, 0, FLOW_MONTHS * sizeof(int64_t));
+    for (int y = 0; y <= AGG_MAX_YEAR - AGG_MIN_YEAR; ++y)
+        for (int m = 0; lg->month_aggs[y] && m < 12; ++m) lg->flow_tree[y * 12 + m] = lg->month_aggs[y][m].income - lg->month_aggs[y][m].expense;
+    fenwick_build(lg->flow_tree, FLOW_MONTHS);
+    lg->flow_tree_ok = 1;
+    return 1;
+}
+
+// Day tree of year y, from its rows in date order; agg_apply keeps it current.
+static int64_t *day_flow_year(int y) {
+    int64_t **df = &lg->day_flow[y - AGG_MIN_YEAR];
+    if (*df) return *df;
+    int first, end = date_index_range(y * 10000, y * 10000 + 9999, &first);
+    if (!lg->date_index_ok || !(*df = calloc(FLOW_DAYS, sizeof(int64_t)))) return NULL;
+    for (int k = first; k < end; ++k) {
+        int slot = lg->date_index[k], i = slot & TXN_PAGE_MASK;
+        const TxnPage *p = txn_page(slot);
+        (*df)[flow_day(p->date[i] / 100 % 100, p->date[i] % 100)] += p->type[i] == TXN_INCOME ? p->amount[i] : -p->amount[i];
+    }
+    fenwick_build(*df, FLOW_DAYS);
+    return *df;
+}
+
+// Every tree at once, for a ledger whose readers must not build anything (the
+// daemon's). Day trees go first: one may fault in a year and void the month tree.
+static void flow_trees_ensure(void) {
+    for (int y = 0; y <= AGG_MAX_YEAR - AGG_MIN_YEAR; ++y) if (lg->month_aggs[y]) day_flow_year(y + AGG_MIN_YEAR);
+    flow_tree_ensure();
+}
+
+// Net flow (income less expense) of every row dated before date, packed
+// yyyymmdd; day 32 stands for the start of the next month. Whole months come
+// off the month tree, so only a partly covered month that has rows needs its
+// year in memory. Only building a tree can fault years in, so only then is the
+// lock taken, keeping part_fault from reloading halfway through.
+static void ledger_lock(int exclusive);  // with the file locking helpers
+static void ledger_unlock(void);
+
+static int64_t flow_before(int date) {
+    int y = date / 10000, m = date / 100 % 100, d = date % 100;
+    if (m < 1 || d < 1) { d = 1; if (m < 1) m = 1; }
+    if (d > 31) { d = 1; m++; }
+    if (m > 12) { m = 1; y++; }
+    if (y < AGG_MIN_YEAR) return 0;
+    int64_t t0 = now_ns(), s = 0;
+    int locked = !lg->flow_tree_ok;
+    if (locked) ledger_lock(0);
+    if (flow_tree_ensure()) s = fenwick_sum(lg->flow_tree, y > AGG_MAX_YEAR ? FLOW_MONTHS : (y - AGG_MIN_YEAR) * 12 + m - 1);
+    MonthAgg *a = y <= AGG_MAX_YEAR && d > 1 ? month_agg(m, y, 0) : NULL;
+    int64_t *df = a && a->income_count + a->expense_count ? lg->day_flow[y - AGG_MIN_YEAR] : NULL;
+    if (a && a->income_count + a->expense_count && !df) {
+        if (!locked) { ledger_lock(0); locked = 1; }
+        df = day_flow_year(y);
+    }
+    if (df) s += fenwick_sum(df, flow_day(m, d)) - fenwick_sum(df, flow_day(m, 1));
+    if (locked) ledger_unlock();
+    stat_time(OP_BALANCE, t0);
+    return s;
+}
+
+static int64_t balance_as_of(int date) { return flow_before(date + 1); }
+
+static int cat_total_cmp(const void *a, const void *b) {
+    const CatTotal *x = a, *y = b;
+    if (x->expense != y->expense) return x->expense < y->expense ? 1 : -1;
+    if (x->income != y->income) return x->income < y->income ? 1 : -1;
+    return x->cat - y->cat;
+}
+
+// Categories with rows in months m_lo..m_hi of year y, biggest spend first.
+// Read off the category cube, so the cost is months x categories, not rows.
+// out needs room for lg->cat_count entries as counted after agg_need_year(y),
+// since faulting the year in can add categories.
+static int cat_totals(int y, int m_lo, int m_hi, CatTotal *out) {
+    int64_t t0 = now_ns();
+    int n = 0;
+    agg_need_year(y);
+    CatYear *cy = y >= AGG_MIN_YEAR && y <= AGG_MAX_YEAR ? lg->cat_aggs[y - AGG_MIN_YEAR] : NULL;
+    for (int c = 0; cy && c < cy->cap && c < lg->cat_count; ++c) {
+        CatTotal t = { c, 0, 0, 0 };
+        for (int m = m_lo; m <= m_hi; ++m) {
+            const CatCell *cell = &cy->cells[c * 12 + m - 1];
+            t.count += cell->count; t.income += cell->income; t.expense += cell->expense;
+        }
+        if (t.count) out[n++] = t;
+    }
+    qsort(out, n, sizeof(CatTotal), cat_total_cmp);
+    stat_time(OP_AGGREGATE, t0);
+    return n;
+}
+
+// Business rules for a new transaction against the month it lands in. Returns
+// -1 with a reason when it must be refused, otherwise TXN_WARN_* bits the
+// caller may want to confirm or report.
+static int txn_check(const Transaction *t, const char **why) {
+    if (t->amount <= 0) { *why = "Invalid amount."; return -1; }
+    if (t->type == TXN_INCOME && t->cat == CAT_SALARY && salary_exists_in_month(t->month, t->year)) {
+        *why = "Salary already added for this month. Cannot add another."; return -1;
+    }
+    if (t->type == TXN_INCOME) return 0;
+    int64_t inc = sum_income_month(t->month, t->year);
+    if (inc <= 0) { *why = "Cannot add expense: no income recorded for this month."; return -1; }
+    int64_t ex = sum_expense_month(t->month, t->year) + t->amount;
+    int warn = 0;
+    if (ex > inc) warn |= TXN_WARN_OVER_INCOME;
+    if (lg->monthly_budget > 0 && ex > lg->monthly_budget) warn |= TXN_WARN_OVER_BUDGET;
+    return warn;
+}
+
+// Filtered sum/count/min/max over one page of hot columns. The SIMD variants
+// build a lane mask from the date, id, type and category columns and add the
+// selected paise with 64-bit integer lanes; the scalar loop handles tails and
+// other CPUs. Integer sums are exact, so every variant gives the same answer.
+static void range_row(const TxnPage *pg, int i, const RangeQuery *q, RangeStats *st) {
+    if (!pg->id[i] || pg->date[i] < q->date_lo || pg->date[i] > q->date_hi) return;
+    if (q->type >= 0 && pg->type[i] != q->type) return;
+    if (q->cat_sel && !q->cat_sel[pg->cat[i]]) return;
+    int64_t a = pg->amount[i];
+    st->sum += a; st->count++;
+    if (a < st->min) st->min = a;
+    if (a > st->max) st->max = a;
+}
+
+static void range_kernel_scalar(const TxnPage *pg, int rows, const RangeQuery *q, RangeStats *st) {
+    for (int i = 0; i < rows; ++i) range_row(pg, i, q, st);
+}
+
+#ifdef HAVE_X86_SIMD
+// SSE2 has 64-bit adds but no 64-bit compares, so min/max visit only the selected lanes.
+__attribute__((target("sse2")))
+static void range_kernel_sse2(const TxnPage *pg, int rows, const RangeQuery *q, RangeStats *st) {
+    const __m128i lo = _mm_set1_epi32(q->date_lo - 1), hi = _mm_set1_epi32(q->date_hi + 1);
+    const __m128i zero = _mm_setzero_si128(), want = _mm_set1_epi32(q->type);
+    __m128i sum = _mm_setzero_si128();
+    int64_t mn = st->min, mx = st->max;
+    long count = 0;
+    int i = 0;
+    for (; i + 4 <= rows; i += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i *)(pg->date + i));
+        __m128i m = _mm_and_si128(_mm_cmpgt_epi32(d, lo), _mm_cmplt_epi32(d, hi));
+        m = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(pg->id + i)), zero), m);
+        if (q->type >= 0) {
+            uint32_t tb; memcpy(&tb, pg->type + i, 4);
+            __m128i t = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int)tb), zero), zero);
+            m = _mm_and_si128(m, _mm_cmpeq_epi32(t, want));
+        }
+        if (q->cat_sel) {
+            const unsigned short *c = pg->cat + i;
+            __m128i sel = _mm_set_epi32(q->cat_sel[c[3]], q->cat_sel[c[2]], q->cat_sel[c[1]], q->cat_sel[c[0]]);
+            m = _mm_andnot_si128(_mm_cmpeq_epi32(sel, zero), m);
+        }
+        int bits = _mm_movemask_ps(_mm_castsi128_ps(m));
+        if (!bits) continue;
+        count += __builtin_popcount(bits);
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(pg->amount + i)), a1 = _mm_loadu_si128((const __m128i *)(pg->amount + i + 2));
+        sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_and_si128(a0, _mm_unpacklo_epi32(m, m)), _mm_and_si128(a1, _mm_unpackhi_epi32(m, m))));
+        for (; bits; bits &= bits - 1) {
+            int64_t a = pg->amount[i + __builtin_ctz(bits)];
+            if (a < mn) mn = a;
+            if (a > mx) mx = a;
+        }
+    }
+    int64_t s2[2];
+    _mm_storeu_si128((__m128i *)s2, sum);
+    st->sum += s2[0] + s2[1]; st->count += count; st->min = mn; st->max = mx;
+    for (; i < rows; ++i) range_row(pg, i, q, st);
+}
+
+__attribute__((target("avx2")))
+static void range_kernel_avx2(const TxnPage *pg, int rows, const RangeQuery *q, RangeStats *st) {
+    const __m256i lo = _mm256_set1_epi32(q->date_lo - 1), hi = _mm256_set1_epi32(q->date_hi);
+    const __m256i zero = _mm256_setzero_si256(), want = _mm256_set1_epi32(q->type);
+    const __m256i big = _mm256_set1_epi64x(INT64_MAX), small = _mm256_set1_epi64x(INT64_MIN);
+    __m256i sum = zero, mn = big, mx = small;
+    long count = 0;
+    int i = 0;
+    for (; i + 8 <= rows; i += 8) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)(pg->date + i));
+        __m256i m = _mm256_andnot_si256(_mm256_cmpgt_epi32(d, hi), _mm256_cmpgt_epi32(d, lo));
+        m = _mm256_andnot_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(pg->id + i)), zero), m);
+        if (q->type >= 0) {
+            __m256i t = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(pg->type + i)));
+            m = _mm256_and_si256(m, _mm256_cmpeq_epi32(t, want));
+        }
+        if (q->cat_sel) {
+            __m256i c = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(pg->cat + i)));
+            m = _mm256_andnot_si256(_mm256_cmpeq_epi32(_mm256_i32gather_epi32(q->cat_sel, c, 4), zero), m);
+        }
+        int bits = _mm256_movemask_ps(_mm256_castsi256_ps(m));
+        if (!bits) continue;
+        count += __builtin_popcount(bits);
+        __m256i m0 = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(m)), m1 = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(m, 1));
+        __m256i a0 = _mm256_loadu_si256((const __m256i *)(pg->amount + i)), a1 = _mm256_loadu_si256((const __m256i *)(pg->amount + i + 4));
+        sum = _mm256_add_epi64(sum, _mm256_add_epi64(_mm256_and_si256(a0, m0), _mm256_and_si256(a1, m1)));
+        __m256i v0 = _mm256_blendv_epi8(big, a0, m0), v1 = _mm256_blendv_epi8(big, a1, m1);
+        mn = _mm256_blendv_epi8(mn, v0, _mm256_cmpgt_epi64(mn, v0));
+        mn = _mm256_blendv_epi8(mn, v1, _mm256_cmpgt_epi64(mn, v1));
+        v0 = _mm256_blendv_epi8(small, a0, m0); v1 = _mm256_blendv_epi8(small, a1, m1);
+        mx = _mm256_blendv_epi8(mx, v0, _mm256_cmpgt_epi64(v0, mx));
+        mx = _mm256_blendv_epi8(mx, v1, _mm256_cmpgt_epi64(v1, mx));
+    }
+    int64_t s4[4], n4[4], x4[4];
+    _mm256_storeu_si256((__m256i *)s4, sum); _mm256_storeu_si256((__m256i *)n4, mn); _mm256_storeu_si256((__m256i *)x4, mx);
+    st->sum += (s4[0] + s4[1]) + (s4[2] + s4[3]); st->count += count;
+    for (int k = 0; k < 4; ++k) { if (n4[k] < st->min) st->min = n4[k]; if (x4[k] > st->max) st->max = x4[k]; }
+    for (; i < rows; ++i) range_row(pg, i, q, st);
+}
+#endif
+
+typedef void (*RangeKernel)(const TxnPage *, int, const RangeQuery *, RangeStats *);
+static RangeKernel range_kernel = NULL;
+static const char *range_kernel_name = "scalar";
+
+// Picked once per process; PF_KERNEL=scalar|sse2|avx2 forces a variant for comparisons.
+static void select_range_kernel(void) {
+    const char *force = getenv("PF_KERNEL");
+    range_kernel = range_kernel_scalar; range_kernel_name = "scalar";
+    if (force && strcmp(force, "scalar") == 0) return;
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && !(force && strcmp(force, "sse2") == 0)) {
+        range_kernel = range_kernel_avx2; range_kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        range_kernel = range_kernel_sse2; range_kernel_name = "sse2";
+    }
+#endif
+}
+
+static void query_range(const RangeQuery *q, RangeStats *st) {
+    if (!range_kernel) select_range_kernel();
+    ledger_need_years(q->date_lo / 10000, q->date_hi / 10000);
+    int64_t t0 = now_ns();
+    st->sum = 0; st->count = 0; st->min = INT64_MAX; st->max = INT64_MIN;
+    for (int p = 0; p < lg->txn_page_count; ++p) range_kernel(lg->txn_pages[p], txn_page_rows(p), q, st);
+    stat_time(OP_AGGREGATE, t0);
+}
+
+// All ledger mutations go through these three so the derived indexes stay in sync.
+// Slot numbers are stable until the next txn_compact_slots(). Each one faults in
+// the years it touches first, so a partition is never written from half its rows.
+static int ledger_insert(const Transaction *t) {
+    ledger_need_year(t->year);
+    part_touch(t->year);
+    int slot = txn_push(t);
+    if (slot < 0) return -1;
+    id_index_put(t->id, slot);
+    date_index_add(slot);
+    text_index_add(slot);
+    if (t->id >= lg->next_id) lg->next_id = t->id + 1;
+    agg_apply(t, +1);
+    return slot;
+}
+
+static void ledger_update(int slot, const Transaction *nt) {
+    Transaction old; txn_load(slot, &old);
+    ledger_need_year(nt->year);
+    part_touch(old.year); part_touch(nt->year);
+    agg_apply(&old, -1);
+    if (old.day != nt->day || old.month != nt->month || old.year != nt->year) {
+        date_index_remove(slot);
+        txn_store(slot, nt);
+        date_index_add(slot);
+    } else txn_store(slot, nt);
+    if (strcmp(old.note, nt->note) != 0) text_index_add(slot);  // old trigrams go stale, not away
+    agg_apply(nt, +1);
+}
+
+// On a miss, loads the partitions whose ID range covers id and looks again.
+static int part_fault_id(int id);
+
+static int find_txn_by_id(int id) {
+    int pos = id > 0 ? id_index_find(id) : -1;
+    if (pos < 0 && id > 0 && part_fault_id(id)) pos = id_index_find(id);
+    return pos < 0 ? -1 : lg->id_index[pos] - 1;
+}
+
+static int delete_txn_by_id(int id) {
+    int pos = id > 0 ? id_index_find(id) : -1;
+    if (pos < 0 && id > 0 && part_fault_id(id)) pos = id_index_find(id);
+    if (pos < 0) return 0;
+    int slot = lg->id_index[pos] - 1;
+    Transaction old; txn_load(slot, &old);
+    part_touch(old.year);
+    agg_apply(&old, -1);
+    date_index_remove(slot);
+    txn_page(slot)->id[slot & TXN_PAGE_MASK] = 0;
+    lg->id_index[pos] = -1;
+    lg->txn_count--;
+    return 1;
+}
+
+// IDs are never reused, even after the highest one is deleted; next_id is persisted in the manifest.
+static int next_txn_id(void) {
+    return lg->next_id;
+}
+
+static void txns_path(const char *user, char *out, int sz) {
+    snprintf(out, sz, "user_%s_txns.csv", user);
+}
+
+// The single-file snapshot that preceded partitions; still read on first login.
+static void ledger_bin_path(const char *user, char *out, int sz) {
+    snprintf(out, sz, "user_%s_txns.bin", user);
+}
+
+static void ledger_manifest_path(const char *user, char *out, int sz) {
+    snprintf(out, sz, "user_%s_txns.manifest", user);
+}
+
+static void ledger_part_path(const char *user, int year, char *out, int sz) {
+    snprintf(out, sz, "user_%s_txns_%04d.bin", user, year);
+}
+
+static void journal_path(const char *user, char *out, int sz) {
+    snprintf(out, sz, "user_%s_txns.journal", user);
+}
+
+static void categories_path(const char *user, char *out, int sz) {
+    snprintf(out, sz, "user_%s_categories.txt", user);
+}
+
+static void settings_path(const char *user, char *out, int sz) {
+    snprintf(out, sz, "user_%s_settings.txt", user);
+}
+
+static void rollup_path(const char *user, char *out, int sz) {
+    snprintf(out, sz, "user_%s_rollup.bin", user);
+}
+
+static void lock_path(const char *user, char *out, int sz) {
+    snprintf(out, sz, "user_%s.lock", user);
+}
+
+// ---- Cross-process safety ---------------------------------------------------
+// Files are never rewritten in place: new contents go to a sibling temp file
+// that is fsync'd and renamed over the old one, so readers and crashes see
+// either the old file or the new one. Sessions that change a user's files
+// hold an exclusive advisory lock on user_<name>.lock; loads hold it shared.
+// (Locks are a no-op on Windows, where the replace is still atomic.)
+
+static FILE *atomic_begin(const char *path, char *tmp, int sz) {
+    snprintf(tmp, sz, "%s.tmp%ld", path, (long)getpid());
+    return fopen(tmp, "wb");
+}
+
+// io is the IO_* kind the bytes are counted under.
+static int atomic_commit(FILE *f, const char *tmp, const char *path, int ok, int io) {
+    long size = ftell(f);
+    if (fflush(f) != 0 || fsync(fileno(f)) != 0) ok = 0;
+    if (fclose(f) != 0) ok = 0;
+#ifdef _WIN32
+    if (ok && !MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) ok = 0;
+#else
+    if (ok && rename(tmp, path) != 0) ok = 0;
+    if (ok) { int d = open(".", O_RDONLY); if (d >= 0) { fsync(d); close(d); } }  // make the rename itself durable
+#endif
+    if (!ok) remove(tmp);
+    else stat_io(io, 0, size);
+    return ok;
+}
+
+static void file_sig(const char *path, FileSig *sig) {
+    struct stat st;
+    memset(sig, 0, sizeof(*sig));
+    if (stat(path, &st) != 0) return;
+    sig->ino = (int64_t)st.st_ino; sig->size = (int64_t)st.st_size;
+#if defined(__linux__)
+    sig->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+    sig->mtime = (int64_t)st.st_mtime;
+#endif
+}
+
+static int lock_fd_wait(int fd, int how) {
+#ifndef _WIN32
+    while (flock(fd, how) < 0) if (errno != EINTR) return 0;
+#else
+    (void)fd; (void)how;
+#endif
+    return 1;
+}
+
+// Nested calls just deepen the hold; the first one decides the mode.
+static void ledger_lock(int exclusive) {
+#ifndef _WIN32
+    if (lg->lock_depth++) return;
+    if (lg->lock_fd < 0) {
+        char path[MAX_LINE]; lock_path(lg->user, path, sizeof(path));
+        lg->lock_fd = open(path, O_RDWR | O_CREAT, 0600);
+    }
+    if (lg->lock_fd >= 0) lock_fd_wait(lg->lock_fd, exclusive ? LOCK_EX : LOCK_SH);
+#else
+    (void)exclusive;
+#endif
+}
+
+static void ledger_unlock(void) {
+#ifndef _WIN32
+    if (--lg->lock_depth == 0 && lg->lock_fd >= 0) lock_fd_wait(lg->lock_fd, LOCK_UN);
+#endif
+}
+
+// Drops the lock file handle when the ledger changes hands (logout).
+static void ledger_release(void) {
+#ifndef _WIN32
+    if (lg->lock_fd >= 0) close(lg->lock_fd);
+#endif
+    lg->lock_fd = -1; lg->lock_depth = 0;
+}
+
+// Returns everything the ledger owns to the heap and leaves it empty; used
+// where ledgers come and go within one process (the benchmark).
+static void ledger_free(void) {
+    for (int p = 0; p < lg->txn_page_count; ++p) { free(lg->txn_pages[p]->text); free(lg->txn_pages[p]); }
+    free(lg->txn_pages); free(lg->id_index); free(lg->date_index); free(lg->cats); free(lg->cat_index); free(lg->parts);
+    text_index_free();
+    for (int y = 0; y <= AGG_MAX_YEAR - AGG_MIN_YEAR; ++y) {
+        free(lg->month_aggs[y]);
+        if (lg->cat_aggs[y]) free(lg->cat_aggs[y]->cells);
+        free(lg->cat_aggs[y]);
+        free(lg->day_flow[y]);
+    }
+    free(lg->flow_tree);
+    if (lg->journal_fp) fclose(lg->journal_fp);
+    ledger_release();
+    memset(lg, 0, sizeof(*lg));
+    lg->lock_fd = -1;
+}
+
+static void today(int *d, int *m, int *y) {
+    time_t now = time(NULL); struct tm tm;
+#ifdef _WIN32
+    localtime_s(&tm, &now);
+#else
+    localtime_r(&now, &tm);
+#endif
+    *d = tm.tm_mday; *m = tm.tm_mon + 1; *y = tm.tm_year + 1900;
+}
+
+static int is_valid_date(const char *d) {
+    int dd, mm, yy;
+    if (sscanf(d, "%d/%d/%d", &dd, &mm, &yy) != 3) return 0;
+    if (mm < 1 || mm > 12) return 0;
+    if (dd < 1 || dd > 31) return 0;
+    if (yy < 1900 || yy > 9999) return 0;
+    return 1;
+}
+
+static void load_default_categories(void) {
+    const char *d[DEFAULT_CAT_COUNT] = {"Salary","Business","Other Income","Grocery","Utilities","Transport","Dining & Food","Shopping","Healthcare","Others"};
+    lg->cat_count = 0;
+    if (lg->cat_index) memset(lg->cat_index, 0, lg->cat_index_cap * sizeof(int));
+    for (int i = 0; i < DEFAULT_CAT_COUNT; ++i) cat_intern(d[i], strlen(d[i]), i < 3 ? TXN_INCOME : TXN_EXPENSE);
+}
+
+static void welcome_animation(const char *username_display) {
+    print_header("Personal Budget Tracker");
+    if (username_display && username_display[0]) {
+        char hello[128]; snprintf(hello, sizeof(hello), "Hello, %s", username_display);
+        print_centered_in_container(hello, C_CYAN);
+    } else {
+        print_centered_in_container("Hello, User", C_CYAN);
+    }
+
+  print_empty_line_in_container();
+    int bar_width = 40;
+    int pad = (TERM_WIDTH - CONTAINER_WIDTH) / 2;
+    // one write per frame: the first carries the whole screen, later ones just the redrawn bar
+    for (int i = 0; i <= bar_width; ++i) {
+        scr_printf("\r%*s%s¦%*s%s[", pad, "", C_B_BLUE, (CONTAINER_WIDTH - bar_width - 4) / 2, "", C_CYAN);
+        scr_fill('#', i); scr_fill('-', bar_width - i);
+        scr_printf("]%s", C_RESET);
+        scr_flush();
+        sleep_ms(30);
+    }
+    scr_printf("%*s%s¦%s\n", CONTAINER_WIDTH - bar_width - 6, "", C_B_BLUE, C_RESET);
+    scr_flush();
+    sleep_ms(150);
+    print_footer();
+}
+
+// users.csv is an append-only log of "name,password" lines; a later line for
+// the same name is a password change. The directory is built once and then
+// only the bytes appended since the last look are read.
+static int user_find(const char *name) {
+    if (!user_index_cap) return -1;
+    unsigned mask = user_index_cap - 1;
+    for (unsigned h = name_hash(name, strlen(name)) & mask; user_index[h]; h = (h + 1) & mask)
+        if (strcmp(users[user_index[h] - 1].name, name) == 0) return user_index[h] - 1;
+    return -1;
+}
+
+static int user_index_rebuild(int cap) {
+    int *ni = calloc(cap, sizeof(int));
+    if (!ni) return 0;
+    free(user_index); user_index = ni; user_index_cap = cap;
+    for (int i = 0; i < user_count; ++i) {
+        unsigned h = name_hash(users[i].name, strlen(users[i].name)) & (cap - 1);
+        while (user_index[h]) h = (h + 1) & (cap - 1);
+        user_index[h] = i + 1;
+    }
+    return 1;
+}
+
+static void user_dir_put(const char *name, const char *pass) {
+    int i = user_find(name);
+    if (i >= 0) { strcpy(users[i].pass, pass); users_superseded++; return; }
+    if (user_count == user_cap) {
+        int ncap = user_cap ? user_cap * 2 : 64;
+        UserRec *nu = realloc(users, ncap * sizeof(*nu));
+        if (!nu) return;
+        users = nu; user_cap = ncap;
+    }
+    if ((user_count + 1) * 2 > user_index_cap && !user_index_rebuild(user_index_cap ? user_index_cap * 2 : 128)) return;
+    i = user_count++;
+    strcpy(users[i].name, name); strcpy(users[i].pass, pass);
+    unsigned mask = user_index_cap - 1, h = name_hash(name, strlen(name)) & mask;
+    while (user_index[h]) h = (h + 1) & mask;
+    user_index[h] = i + 1;
+}
+
+static void user_dir_refresh(void) {
+    FILE *f = fopen(USERS_CSV, "rb");
+    if (!f) return;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    struct stat st;
+    int64_t ino = fstat(fileno(f), &st) == 0 ? (int64_t)st.st_ino : 0;
+    if (ino != users_ino || size < users_tail) {  // replaced (compacted) by another process: start over
+        users_ino = ino;
+        user_count = 0; users_tail = 0; users_superseded = 0;
+        if (user_index) memset(user_index, 0, user_index_cap * sizeof(int));
+    }
+    if (size > users_tail) {
+        long start = users_tail;
+        fseek(f, users_tail, SEEK_SET);
+        char line[MAX_LINE];
+        while (fgets(line, sizeof(line), f)) {
+            size_t n = strlen(line);
+            if (line[n - 1] != '\n') {
+                if (feof(f)) break;  // partial append still in flight; pick it up next time
+                int c; while ((c = fgetc(f)) != EOF && c != '\n') n++;  // overlong line: skip it
+                users_tail += (long)n + (c == '\n');
+                continue;
+            }
+            users_tail += (long)n;
+            char u[64], penc[128];
+            if (sscanf(line, "%63[^,],%127[^\n]", u, penc) == 2) user_dir_put(u, penc);
+        }
+        stat_io(IO_USERS, users_tail - start, 0);
+    }
+    fclose(f);
+}
+
+static int verify_user_file(const char *username, const char *password) {
+    int64_t t0 = now_ns();
+    user_dir_refresh();
+    int i = user_find(username), ok = 0;
+    if (i >= 0) { char dec[128]; strcpy(dec, users[i].pass); xor_str(dec); ok = strcmp(dec, password) == 0; }
+    stat_time(OP_LOGIN, t0);
+    return ok;
+}
+
+static int user_exists(const char *username) {
+    user_dir_refresh();
+    return user_find(username) >= 0;
+}
+
+// Serializes appends against compaction across processes; -1 when unavailable.
+static int users_lock(void) {
+#ifndef _WIN32
+    int fd = open("users.lock", O_RDWR | O_CREAT, 0600);
+    if (fd >= 0 && !lock_fd_wait(fd, LOCK_EX)) { close(fd); fd = -1; }
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+static void users_unlock(int fd) {
+#ifndef _WIN32
+    if (fd >= 0) close(fd);  // closing drops the flock
+#else
+    (void)fd;
+#endif
+}
+
+// One record, one write(): the line is formatted up front and appended whole.
+// A later line for a name shadows earlier ones, so a new account is checked
+// for under the lock (-1 when the name is taken); a password change is not.
+static int users_append(const char *name, const char *plain, int new_account) {
+    char enc[128]; strncpy(enc, plain, sizeof(enc)-1); enc[sizeof(enc)-1] = '\0'; xor_str(enc);
+    char rec[256]; int n = snprintf(rec, sizeof(rec), "%s,%s\n", name, enc);
+    int lk = users_lock();
+    if (new_account) {
+        user_dir_refresh();
+        if (user_find(name) >= 0) { users_unlock(lk); return -1; }
+    }
+    FILE *f = fopen(USERS_CSV, "ab");
+    if (!f) { users_unlock(lk); return 0; }
+    setvbuf(f, NULL, _IOFBF, sizeof(rec));
+    int ok = fwrite(rec, 1, n, f) == (size_t)n;
+    if (fclose(f) != 0) ok = 0;
+    if (ok) stat_io(IO_USERS, 0, n);
+    users_unlock(lk);
+    user_dir_refresh();
+    return ok;
+}
+
+// Drops shadowed password lines once they outnumber the live accounts.
+static void users_compact(void) {
+    if (users_superseded < USERS_COMPACT_MIN || users_superseded < user_count) return;
+    int lk = users_lock();
+    user_dir_refresh();  // fold in anything appended before we took the lock
+    char tmp[64];
+    FILE *t = atomic_begin(USERS_CSV, tmp, sizeof(tmp));
+    if (!t) { users_unlock(lk); return; }
+    int ok = 1;
+    for (int i = 0; i < user_count; ++i) if (fprintf(t, "%s,%s\n", users[i].name, users[i].pass) < 0) ok = 0;
+    atomic_commit(t, tmp, USERS_CSV, ok, IO_USERS);
+    users_unlock(lk);
+    user_dir_refresh();
+}
+
+static int user_register(const char *name, const char *password) {
+    int r = users_append(name, password, 1);
+    return r < 0 ? 0 : r ? 1 : -1;
+}
+
+static int user_set_password(const char *name, const char *password) {
+    if (!users_append(name, password, 0)) return 0;
+    users_compact();
+    return 1;
+}
+
+// One "Income,<name>" or "Expense,<name>" line per non-default category.
+static void load_categories_for_user(const char *username) {
+    char path[MAX_LINE]; categories_path(username, path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    char line[MAX_LINE];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        char *name = strchr(line, ',');
+        if (!name || !name[1]) continue;
+        *name++ = '\0';
+        cat_intern(name, strlen(name), strcasecmp(line, "Income") == 0 ? TXN_INCOME : TXN_EXPENSE);
+    }
+    stat_io(IO_CATEGORIES, ftell(f), 0);
+    fclose(f);
+}
+
+// Merges in categories other sessions saved meanwhile, then replaces the file.
+static void save_categories_for_user(const char *username) {
+    char path[MAX_LINE], tmp[MAX_LINE + 32]; categories_path(username, path, sizeof(path));
+    ledger_lock(1);
+    load_categories_for_user(username);
+    FILE *f = atomic_begin(path, tmp, sizeof(tmp));
+    if (f) {
+        int ok = 1;
+        for (int i = DEFAULT_CAT_COUNT; i < lg->cat_count; ++i)
+            if (fprintf(f, "%s,%s\n", txn_type_name(lg->cats[i].kind), lg->cats[i].name) < 0) ok = 0;
+        atomic_commit(f, tmp, path, ok, IO_CATEGORIES);
+    }
+    ledger_unlock();
+}
+
+static int add_category(const char *name, int kind) {
+    int before = lg->cat_count, id = cat_intern(name, strlen(name), kind);
+    if (id >= 0 && lg->cat_count != before) save_categories_for_user(lg->user);
+    return id;
+}
+
+// Paise as rupees with two decimals, written backwards so the text ends just
+// before end; returns its length. No floating point is involved anywhere.
+static int format_paise(char *end, int64_t paise) {
+    char *p = end; int neg = paise < 0;
+    uint64_t u = neg ? -(uint64_t)paise : (uint64_t)paise;
+    *--p = (char)('0' + u % 10); u /= 10;
+    *--p = (char)('0' + u % 10); u /= 10;
+    *--p = '.';
+    do { *--p = (char)('0' + u % 10); u /= 10; } while (u);
+    if (neg) *--p = '-';
+    return (int)(end - p);
+}
+
+// For printf-style call sites (%s in place of %.2f). Rotates through a few
+// buffers so one call can format several amounts.
+static const char *money_str(int64_t paise) {
+    static THREAD_LOCAL char bufs[4][32];
+    static THREAD_LOCAL int next;
+    char *b = bufs[next++ & 3];
+    b[31] = '\0';
+    return b + 31 - format_paise(b + 31, paise);
+}
+
+static void write_txn_row(FILE *f, const Transaction *t) {
+    // Ensure note does not contain commas by replacing with semi-colons (maintains CSV integrity)
+    char safe_note[192]; strncpy(safe_note, t->note, sizeof(safe_note)-1); safe_note[sizeof(safe_note)-1]='\0';
+    for (int j=0; safe_note[j]; ++j) if (safe_note[j] == ',') safe_note[j] = ';';
+    fprintf(f, "%d,%s,%s,%s,%02d/%02d/%04d,%s\n", 
+            t->id, txn_type_name(t->type), cat_name(t->cat), money_str(t->amount), t->day, t->month, t->year, safe_note);
+}
+
+static int csv_open(CsvReader *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+    if (!(r->f = fopen(path, "rb"))) return 0;
+    if (!(r->buf = malloc(CSV_BLOCK))) { fclose(r->f); r->f = NULL; return 0; }
+    return 1;
+}
+
+static void csv_close(CsvReader *r) {
+    if (r->f) fclose(r->f);
+    free(r->buf);
+    r->f = NULL; r->buf = NULL;
+}
+
+// Returns 1 with the next line (no terminator, not NUL-terminated), 0 at end of
+// file, or -1 for a line longer than CSV_BLOCK, which is skipped whole.
+static int csv_next_line(CsvReader *r, const char **line, size_t *len) {
+    int too_long = 0;
+    for (;;) {
+        char *start = r->buf + r->pos;
+        char *nl = memchr(start, '\n', r->len - r->pos);
+        if (nl || (r->eof && r->pos < r->len)) {
+            size_t n = nl ? (size_t)(nl - start) : r->len - r->pos;
+            r->pos += nl ? n + 1 : n;
+            r->line_no++;
+            if (too_long) return -1;
+            if (n && start[n - 1] == '\r') n--;
+            *line = start; *len = n;
+            return 1;
+        }
+        if (r->eof) { if (too_long) { r->line_no++; return -1; } return 0; }
+        if (r->pos == 0 && r->len == CSV_BLOCK) { too_long = 1; r->len = 0; }
+        else { memmove(r->buf, start, r->len - r->pos); r->len -= r->pos; r->pos = 0; }
+        size_t got = fread(r->buf + r->len, 1, CSV_BLOCK - r->len, r->f);
+        r->len += got;
+        if (!got) r->eof = 1;
+    }
+}
+
+static const char *span_to(const char *p, const char *e, char c) {
+    const char *q = memchr(p, c, e - p);
+    return q ? q : e;
+}
+
+static void copy_span(char *dst, size_t cap, const char *p, const char *e) {
+    size_t n = e - p;
+    if (n >= cap) n = cap - 1;
+    memcpy(dst, p, n); dst[n] = '\0';
+}
+
+// Plain ASCII conversions; deliberately not strtol/atof, which consult the locale.
+static int parse_int_span(const char *p, const char *e, int *out) {
+    int neg = 0; long long v = 0;
+    if (p < e && (*p == '-' || *p == '+')) neg = *p++ == '-';
+    if (p == e || e - p > 10) return 0;
+    for (; p < e; ++p) {
+        if (*p < '0' || *p > '9') return 0;
+        v = v * 10 + (*p - '0');
+    }
+    if (v > 2147483647LL) return 0;
+    *out = neg ? (int)-v : (int)v;
+    return 1;
+}
+
+// Decimal amount to paise; digits past the second decimal place round half up.
+static int parse_paise_span(const char *p, const char *e, int64_t *out) {
+    while (p < e && *p == ' ') p++;
+    while (e > p && e[-1] == ' ') e--;
+    int neg = 0, digits = 0, frac = 0, round_up = 0;
+    int64_t v = 0;
+    if (p < e && (*p == '-' || *p == '+')) neg = *p++ == '-';
+    for (; p < e && *p >= '0' && *p <= '9'; ++p, ++digits) {
+        if (v > INT64_MAX / 1000) return 0;
+        v = v * 10 + (*p - '0');
+    }
+    if (p < e && *p == '.') {
+        for (++p; p < e && *p >= '0' && *p <= '9'; ++p, ++digits) {
+            if (frac < 2) { v = v * 10 + (*p - '0'); frac++; }
+            else if (frac == 2) { round_up = *p >= '5'; frac++; }
+        }
+    }
+    if (p != e || !digits) return 0;
+    for (; frac < 2; ++frac) v *= 10;
+    v += round_up;
+    *out = neg ? -v : v;
+    return 1;
+}
+
+static int parse_money(const char *s, int64_t *out) { return parse_paise_span(s, s + strlen(s), out); }
+
+// Mean in paise, rounded half away from zero.
+static int64_t paise_avg(int64_t sum, long n) { return (sum + (sum < 0 ? -n : n) / 2) / n; }
+
+// id,type,category,amount,DD/MM/YYYY,note -- the note runs to end of line and may be empty.
+static int parse_txn_fields(const char *p, const char *e, Transaction *t, const char **why) {
+    const char *fe;
+    memset(t, 0, sizeof(*t));
+    fe = span_to(p, e, ',');
+    if (fe == e || !parse_int_span(p, fe, &t->id) || t->id <= 0) { *why = "bad id"; return 0; }
+    p = fe + 1; fe = span_to(p, e, ',');
+    if (fe == e) { *why = "missing fields"; return 0; }
+    t->type = (fe - p == 6 && strncasecmp(p, "Income", 6) == 0) ? TXN_INCOME : TXN_EXPENSE;
+    p = fe + 1; fe = span_to(p, e, ',');
+    if (fe == e) { *why = "missing fields"; return 0; }
+    if ((t->cat = cat_intern(p, fe - p, t->type)) < 0) { *why = "too many categories"; return 0; }
+    p = fe + 1; fe = span_to(p, e, ',');
+    if (fe == e || !parse_paise_span(p, fe, &t->amount)) { *why = "bad amount"; return 0; }
+    p = fe + 1; fe = span_to(p, e, ',');
+    const char *s1 = span_to(p, fe, '/'), *s2 = s1 < fe ? span_to(s1 + 1, fe, '/') : fe;
+    if (fe == e || s2 == fe || !parse_int_span(p, s1, &t->day) || !parse_int_span(s1 + 1, s2, &t->month)
+        || !parse_int_span(s2 + 1, fe, &t->year) || t->day < 1 || t->day > 31 || t->month < 1 || t->month > 12
+        || t->year < AGG_MIN_YEAR || t->year > AGG_MAX_YEAR) { *why = "bad date"; return 0; }
+    copy_span(t->note, sizeof(t->note), fe + 1, e);
+    return 1;
+}
+
+static void report_bad_line(const char *path, long line_no, const char *why) {
+    if (load_bad_lines++ == 0) snprintf(load_warning, sizeof(load_warning), "%.100s:%ld: %s", path, line_no, why);
+}
+
+static void show_load_warnings(void) {
+    if (!load_bad_lines) return;
+    char msg[64]; snprintf(msg, sizeof(msg), "Skipped %d malformed line(s). First:", load_bad_lines);
+    print_error(msg);
+    print_centered_in_container(load_warning, C_YELLOW);
+    load_bad_lines = 0;
+}
+
+static unsigned char *map_file(const char *path, size_t *size) {
+#ifdef _WIN32
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END); long n = ftell(f); fseek(f, 0, SEEK_SET);
+    unsigned char *p = n > 0 ? malloc(n) : NULL;
+    if (p && fread(p, 1, n, f) != (size_t)n) { free(p); p = NULL; }
+    fclose(f);
+    *size = p ? (size_t)n : 0;
+    return p;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return NULL;
+    *size = st.st_size;
+    return p;
+#endif
+}
+
+static void unmap_file(unsigned char *p, size_t size) {
+#ifdef _WIN32
+    (void)size; free(p);
+#else
+    munmap(p, size);
+#endif
+}
+
+static int write_section(FILE *f, uint64_t *pos, uint64_t *off, const void *data, size_t len) {
+    static const char zeros[8];
+    size_t pad = (size_t)((8 - (*pos & 7)) & 7);
+    if (pad && fwrite(zeros, 1, pad, f) != pad) return 0;
+    *pos += pad; *off = *pos;
+    if (len && fwrite(data, 1, len, f) != len) return 0;
+    *pos += len;
+    return 1;
+}
+
+// Writes one year's live rows as a snapshot file and fills in its manifest
+// entry; a year left without rows loses its file instead.
+static int save_partition(const char *username, int year, PartEntry *e) {
+    char path[MAX_LINE]; ledger_part_path(username, year, path, sizeof(path));
+    uint32_t n = 0, nc = (uint32_t)lg->cat_count, note_bytes = 0, name_bytes = 0;
+    e->year = year; e->min_id = INT32_MAX; e->max_id = 0;
+    for (int p = 0; p < lg->txn_page_count; ++p) {
+        const TxnPage *pg = lg->txn_pages[p];
+        for (int i = 0, rows = txn_page_rows(p); i < rows; ++i) {
+            if (!pg->id[i] || pg->date[i] / 10000 != year) continue;
+            n++;
+            if (pg->id[i] < e->min_id) e->min_id = pg->id[i];
+            if (pg->id[i] > e->max_id) e->max_id = pg->id[i];
+        }
+    }
+    if (!(e->count = n)) return 1;  // its file goes once the manifest no longer names it
+    int32_t *ids = malloc((n + 1) * sizeof(int32_t));
+    uint32_t *dates = malloc((n + 1) * sizeof(uint32_t)), *note_offs = malloc((n + 1) * sizeof(uint32_t));
+    uint8_t *types = malloc(n + 1);
+    uint16_t *catx = malloc((n + 1) * sizeof(uint16_t));
+    int64_t *amounts = malloc((n + 1) * sizeof(int64_t));
+    uint32_t *name_offs = malloc((nc + 1) * sizeof(uint32_t));
+    char *notes = NULL, *name_heap = NULL;
+    int ok = 0;
+    if (!ids || !dates || !note_offs || !types || !catx || !amounts || !name_offs) goto done;
+
+    uint32_t k = 0;
+    for (uint32_t c = 0; c < nc; ++c) name_bytes += strlen(lg->cats[c].name);
+    for (int p = 0; p < lg->txn_page_count; ++p) {
+        TxnPage *pg = lg->txn_pages[p];
+        for (int i = 0, rows = txn_page_rows(p); i < rows; ++i) {
+            if (!pg->id[i] || pg->date[i] / 10000 != year) continue;
+            ids[k] = pg->id[i]; dates[k] = (uint32_t)pg->date[i]; types[k] = pg->type[i];
+            catx[k] = pg->cat[i]; amounts[k] = pg->amount[i];
+            note_offs[k] = note_bytes; note_bytes += strlen(pg->text[i].note);
+            k++;
+        }
+    }
+    note_offs[k] = note_bytes;
+    notes = malloc(note_bytes + 1); name_heap = malloc(name_bytes + 1);
+    if (!notes || !name_heap) goto done;
+    k = 0;
+    for (int p = 0; p < lg->txn_page_count; ++p) {
+        TxnPage *pg = lg->txn_pages[p];
+        for (int i = 0, rows = txn_page_rows(p); i < rows; ++i) {
+            if (!pg->id[i] || pg->date[i] / 10000 != year) continue;
+            memcpy(notes + note_offs[k], pg->text[i].note, note_offs[k + 1] - note_offs[k]); k++;
+        }
+    }
+    name_bytes = 0;
+    for (uint32_t c = 0; c < nc; ++c) {
+        size_t len = strlen(lg->cats[c].name);
+        name_offs[c] = name_bytes; memcpy(name_heap + name_bytes, lg->cats[c].name, len); name_bytes += len;
+    }
+    name_offs[nc] = name_bytes;
+
+    char tmp[MAX_LINE + 32];
+    FILE *f = atomic_begin(path, tmp, sizeof(tmp));
+    if (!f) goto done;
+    LedgerFileHeader h; memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LEDGER_MAGIC, 8);
+    h.version = LEDGER_VERSION; h.count = n; h.next_id = lg->next_id; h.cat_count = nc;
+    uint64_t pos = sizeof(h);
+    ok = fwrite(&h, sizeof(h), 1, f) == 1
+      && write_section(f, &pos, &h.off_ids, ids, n * sizeof(int32_t))
+      && write_section(f, &pos, &h.off_dates, dates, n * sizeof(uint32_t))
+      && write_section(f, &pos, &h.off_types, types, n)
+      && write_section(f, &pos, &h.off_cats, catx, n * sizeof(uint16_t))
+      && write_section(f, &pos, &h.off_amounts, amounts, n * sizeof(int64_t))
+      && write_section(f, &pos, &h.off_note_offs, note_offs, (n + 1) * sizeof(uint32_t))
+      && write_section(f, &pos, &h.off_notes, notes, note_bytes)
+      && write_section(f, &pos, &h.off_cat_offs, name_offs, (nc + 1) * sizeof(uint32_t))
+      && write_section(f, &pos, &h.off_cat_names, name_heap, name_bytes);
+    h.file_size = pos;
+    // header goes in last, once the section offsets are known
+    if (ok) ok = fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1;
+    ok = atomic_commit(f, tmp, path, ok, IO_SNAPSHOT);
+done:
+    free(ids); free(dates); free(note_offs); free(types); free(catx); free(amounts);
+    free(name_offs); free(notes); free(name_heap);
+    return ok;
+}
+
+// Position of year in lg->parts, or -(insertion point) - 1.
+static int part_index(int year) {
+    int lo = 0, hi = lg->part_count;
+    while (lo < hi) { int mid = (lo + hi) >> 1; if (lg->parts[mid].year < year) lo = mid + 1; else hi = mid; }
+    return lo < lg->part_count && lg->parts[lo].year == year ? lo : -lo - 1;
+}
+
+static int part_set(const PartEntry *e) {
+    int pos = part_index(e->year);
+    if (pos >= 0) {
+        if (e->count) lg->parts[pos] = *e;
+        else memmove(&lg->parts[pos], &lg->parts[pos + 1], (--lg->part_count - pos) * sizeof(PartEntry));
+        return 1;
+    }
+    if (!e->count) return 1;
+    if (lg->part_count == lg->part_cap) {
+        int ncap = lg->part_cap ? lg->part_cap * 2 : 32;
+        PartEntry *np = realloc(lg->parts, ncap * sizeof(PartEntry));
+        if (!np) return 0;
+        lg->parts = np; lg->part_cap = ncap;
+    }
+    pos = -pos - 1;
+    memmove(&lg->parts[pos + 1], &lg->parts[pos], (lg->part_count - pos) * sizeof(PartEntry));
+    lg->parts[pos] = *e; lg->part_count++;
+    return 1;
+}
+
+static int save_manifest(const char *username) {
+    char path[MAX_LINE], tmp[MAX_LINE + 32]; ledger_manifest_path(username, path, sizeof(path));
+    FILE *f = atomic_begin(path, tmp, sizeof(tmp));
+    if (!f) return 0;
+    ManifestHeader h; memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MANIFEST_MAGIC, 8);
+    h.version = MANIFEST_VERSION; h.part_count = (uint32_t)lg->part_count; h.next_id = lg->next_id;
+    h.generation = lg->generation + 1;
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1
+          && (!lg->part_count || fwrite(lg->parts, sizeof(PartEntry), lg->part_count, f) == (size_t)lg->part_count);
+    if ((ok = atomic_commit(f, tmp, path, ok, IO_SNAPSHOT))) { file_sig(path, &lg->snap); lg->generation = h.generation; }
+    return ok;
+}
+
+static int save_rollup(const char *username);  // with the partition loaders
+
+// Rewrites only the years changed since they were read, then the manifest.
+// A year whose file could not be read is never overwritten; the save fails
+// and the journal keeps its changes instead.
+static int save_transactions_for_user(const char *username) {
+    int64_t t0 = now_ns();
+    int ok = 1, wrote = 0;
+    for (int y = AGG_MIN_YEAR; y <= AGG_MAX_YEAR && ok; ++y) {
+        unsigned char fl = lg->part_flags[y - AGG_MIN_YEAR];
+        if (!(fl & PART_DIRTY)) continue;
+        PartEntry e;
+        ok = !(fl & PART_BROKEN) && save_partition(username, y, &e) && part_set(&e);
+        wrote++;
+    }
+    if (ok && (wrote || lg->legacy_snapshot) && (ok = save_manifest(username))) save_rollup(username);  // if this fails, the next login rebuilds it
+    if (ok) {
+        for (int y = 0; y <= AGG_MAX_YEAR - AGG_MIN_YEAR; ++y) {
+            if ((lg->part_flags[y] & PART_DIRTY) && part_index(y + AGG_MIN_YEAR) < 0) {
+                char path[MAX_LINE]; ledger_part_path(username, y + AGG_MIN_YEAR, path, sizeof(path));
+                remove(path);
+            }
+            lg->part_flags[y] &= ~PART_DIRTY;
+        }
+        if (lg->legacy_snapshot) {
+            char path[MAX_LINE]; ledger_bin_path(username, path, sizeof(path));
+            remove(path);
+            lg->legacy_snapshot = 0;
+        }
+    }
+    stat_time(OP_SAVE, t0);
+    return ok;
+}
+
+// Folds the journal into the partitions. Replay is idempotent (A/E upsert, D ignores
+// missing ids), so a crash between the partition writes and the remove is harmless.
+static void ledger_begin_write(void);  // with the session helpers, after the loaders it uses
+
+static int compact_transactions_for_user(const char *username) {
+    ledger_begin_write();  // picks up other sessions' records before they are folded in
+    if (!txn_compact_slots()) { ledger_unlock(); return 0; }  // the journal still holds everything
+    if (lg->journal_fp) { fclose(lg->journal_fp); lg->journal_fp = NULL; }
+    int ok = save_transactions_for_user(username);
+    if (ok) {
+        save_categories_for_user(username);
+        char path[MAX_LINE]; journal_path(username, path, sizeof(path));
+        remove(path);
+        lg->journal_records = 0; lg->journal_pos = 0;
+    }
+    ledger_unlock();
+    return ok;
+}
+
+static int journal_open(void) {
+    if (lg->journal_fp) return 1;
+    char path[MAX_LINE]; journal_path(lg->user, path, sizeof(path));
+    return (lg->journal_fp = fopen(path, "a")) != NULL;
+}
+
+// Every mutation is one appended line: "A,<row>", "E,<row>" or "D,<id>".
+// Callers hold the write lock (ledger_begin_write) around the change and this.
+static int journal_append(char op, const Transaction *t) {
+    if (!journal_open()) return 0;
+    int64_t t0 = now_ns();
+    long before = ftell(lg->journal_fp);
+    if (op == 'D') fprintf(lg->journal_fp, "D,%d\n", t->id);
+    else { fprintf(lg->journal_fp, "%c,", op); write_txn_row(lg->journal_fp, t); }
+    fflush(lg->journal_fp);
+    lg->journal_pos = ftell(lg->journal_fp);
+    lg->journal_records++;
+    stat_io(IO_JOURNAL, 0, lg->journal_pos - before);
+    stat_time(OP_JOURNAL, t0);
+    if (lg->journal_records > JOURNAL_COMPACT_MIN && lg->journal_records > lg->txn_count / 2)
+        compact_transactions_for_user(lg->user);
+    return 1;
+}
+
+static int journal_append_batch(const TxnBatch *b) {
+    if (!b->accepted) return 1;
+    if (!journal_open()) return 0;
+    int64_t t0 = now_ns();
+    long before = ftell(lg->journal_fp);
+    for (int i = 0; i < b->count; ++i) {
+        if (b->why[i]) continue;
+        fputs("A,", lg->journal_fp); write_txn_row(lg->journal_fp, &b->rows[i]);
+    }
+    fflush(lg->journal_fp);
+    lg->journal_pos = ftell(lg->journal_fp);
+    lg->journal_records += b->accepted;
+    stat_io(IO_JOURNAL, 0, lg->journal_pos - before);
+    stat_time(OP_JOURNAL, t0);
+    if (lg->journal_records > JOURNAL_COMPACT_MIN && lg->journal_records > lg->txn_count / 2)
+        compact_transactions_for_user(lg->user);
+    return 1;
+}
+
+// Applies journal records from byte offset 'from' on; records are idempotent
+// upserts/deletes, so applying one twice is harmless.
+static void replay_journal_for_user(const char *username, long from) {
+    if (!from) lg->journal_records = 0;
+    lg->journal_pos = from;
+    char path[MAX_LINE]; journal_path(username, path, sizeof(path));
+    CsvReader r;
+    if (!csv_open(&r, path)) return;
+    if (from && fseek(r.f, from, SEEK_SET) != 0) { csv_close(&r); return; }
+    const char *line, *why = "line too long";
+    size_t len;
+    int rc, id;
+    while ((rc = csv_next_line(&r, &line, &len)) != 0) {
+        const char *e = line + len;
+        if (rc < 0 || len < 2 || line[1] != ',') { if (len) report_bad_line(path, r.line_no, rc < 0 ? why : "unknown record"); continue; }
+        if (line[0] == 'D') {
+            if (!parse_int_span(line + 2, e, &id)) { report_bad_line(path, r.line_no, "bad id"); continue; }
+            delete_txn_by_id(id);
+        } else if (line[0] == 'A' || line[0] == 'E') {
+            Transaction t;
+            // a torn final record from a crash lands here too
+            if (!parse_txn_fields(line + 2, e, &t, &why)) { report_bad_line(path, r.line_no, why); continue; }
+            ledger_need_year(t.year);  // the row may already sit in a partition saved just before a crash
+            int cur = find_txn_by_id(t.id);
+            if (cur >= 0) ledger_update(cur, &t);
+            else ledger_insert(&t);
+        } else { report_bad_line(path, r.line_no, "unknown record"); continue; }
+        lg->journal_records++;
+    }
+    lg->journal_pos = ftell(r.f);
+    stat_io(IO_JOURNAL, lg->journal_pos - from, 0);
+    csv_close(&r);
+}
+
+static void ledger_reset(void) {
+    lg->txn_slots = lg->txn_count = 0;
+    lg->next_id = 1;
+    if (lg->id_index) memset(lg->id_index, 0, lg->id_index_cap * sizeof(int));
+    lg->id_index_used = 0;
+    lg->date_index_len = 0; lg->date_index_ok = 0;
+    lg->text_index_ok = 0;
+    lg->part_count = 0; lg->legacy_snapshot = 0; lg->generation = 0;
+    memset(lg->part_flags, 0, sizeof(lg->part_flags));
+    agg_reset();
+}
+
+static int section_ok(const LedgerFileHeader *h, uint64_t off, uint64_t len) {
+    return off >= sizeof(*h) && off <= h->file_size && len <= h->file_size - off;
+}
+
+static void copy_heap_str(char *dst, size_t cap, const char *heap, uint32_t from, uint32_t to) {
+    size_t len = to - from;
+    if (len >= cap) len = cap - 1;
+    memcpy(dst, heap + from, len); dst[len] = '\0';
+}
+
+// Maps a snapshot file and checks every section and offset; NULL if it is
+// missing or invalid. Release with unmap_file(base, *size).
+static unsigned char *ledger_file_map(const char *path, size_t *psize) {
+    size_t size;
+    unsigned char *base = map_file(path, &size);
+    if (!base) return NULL;
+    stat_io(IO_SNAPSHOT, (int64_t)size, 0);
+    const LedgerFileHeader *h = (const LedgerFileHeader *)base;
+    uint64_t n = size >= sizeof(*h) ? h->count : 0, nc = size >= sizeof(*h) ? h->cat_count : 0;
+    int ok = size >= sizeof(*h) && memcmp(h->magic, LEDGER_MAGIC, 8) == 0 && h->version == LEDGER_VERSION
+          && h->file_size == size
+          && section_ok(h, h->off_ids, n * 4) && section_ok(h, h->off_dates, n * 4)
+          && section_ok(h, h->off_types, n) && section_ok(h, h->off_cats, n * 2)
+          && section_ok(h, h->off_amounts, n * 8) && section_ok(h, h->off_note_offs, (n + 1) * 4)
+          && section_ok(h, h->off_cat_offs, (nc + 1) * 4);
+    const uint32_t *note_offs = ok ? (const uint32_t *)(base + h->off_note_offs) : NULL;
+    const uint32_t *cat_offs = ok ? (const uint32_t *)(base + h->off_cat_offs) : NULL;
+    const uint16_t *catx = ok ? (const uint16_t *)(base + h->off_cats) : NULL;
+    if (ok) ok = note_offs[0] == 0 && cat_offs[0] == 0
+              && section_ok(h, h->off_notes, note_offs[n]) && section_ok(h, h->off_cat_names, cat_offs[nc]);
+    for (uint64_t i = 0; ok && i < n; ++i) ok = note_offs[i] <= note_offs[i + 1] && catx[i] < nc;
+    for (uint64_t c = 0; ok && c < nc; ++c) ok = cat_offs[c] <= cat_offs[c + 1];
+    if (!ok) { unmap_file(base, size); return NULL; }
+    *psize = size;
+    return base;
+}
+
+// Returns 0 if the file is missing or fails validation; the caller then falls back to the CSV.
+static int load_transactions_bin(const char *path) {
+    size_t size;
+    unsigned char *base = ledger_file_map(path, &size);
+    if (!base) return 0;
+    const LedgerFileHeader *h = (const LedgerFileHeader *)base;
+    uint64_t n = h->count, nc = h->cat_count;
+    const uint32_t *note_offs = (const uint32_t *)(base + h->off_note_offs), *cat_offs = (const uint32_t *)(base + h->off_cat_offs);
+    const uint16_t *catx = (const uint16_t *)(base + h->off_cats);
+    const int32_t *ids = (const int32_t *)(base + h->off_ids);
+    const uint32_t *dates = (const uint32_t *)(base + h->off_dates);
+    const uint8_t *types = base + h->off_types;
+    const int64_t *amounts = (const int64_t *)(base + h->off_amounts);
+    const char *notes = (const char *)base + h->off_notes, *names = (const char *)base + h->off_cat_names;
+    // Map file category numbers onto the session dictionary; a name not seen
+    // before takes its kind from the first row that uses it.
+    int *remap = malloc((nc + 1) * sizeof(int));
+    if (!remap) { unmap_file(base, size); return 0; }
+    for (uint64_t c = 0; c < nc; ++c) remap[c] = -1;
+    for (uint64_t i = 0; i < n; ++i) {
+        int c = catx[i];
+        if (remap[c] < 0) remap[c] = cat_intern(names + cat_offs[c], cat_offs[c + 1] - cat_offs[c], types[i] ? TXN_EXPENSE : TXN_INCOME);
+        if (remap[c] < 0) break;
+        Transaction t; memset(&t, 0, sizeof(t));
+        t.id = ids[i];
+        t.year = dates[i] / 10000; t.month = dates[i] / 100 % 100; t.day = dates[i] % 100;
+        t.type = types[i] ? TXN_EXPENSE : TXN_INCOME;
+        t.cat = remap[c];
+        t.amount = amounts[i];
+        copy_heap_str(t.note, sizeof(t.note), notes, note_offs[i], note_offs[i + 1]);
+        if (ledger_insert(&t) < 0) break;
+    }
+    if (h->next_id > lg->next_id) lg->next_id = h->next_id;
+    free(remap);
+    unmap_file(base, size);
+    return 1;
+}
+
+// Streams a ledger CSV through fn; blank and '#' lines are skipped, bad rows reported.
+static int scan_transactions_csv(const char *path, int (*fn)(Transaction *)) {
+    CsvReader r;
+    if (!csv_open(&r, path)) return -1;
+    const char *line, *why;
+    size_t len;
+    int rc, n = 0;
+    while ((rc = csv_next_line(&r, &line, &len)) != 0) {
+        Transaction t;
+        if (rc < 0) { report_bad_line(path, r.line_no, "line too long"); continue; }
+        if (len == 0) continue;
+        if (line[0] == '#') {
+            int hint;
+            if (len > 9 && memcmp(line, "#next_id,", 9) == 0 && parse_int_span(line + 9, line + len, &hint) && hint > lg->next_id) lg->next_id = hint;
+            continue;
+        }
+        if (!parse_txn_fields(line, line + len, &t, &why)) { report_bad_line(path, r.line_no, why); continue; }
+        scan_line_no = r.line_no;
+        if (!fn(&t)) break;
+        n++;
+    }
+    csv_close(&r);
+    return n;
+}
+
+static int load_csv_row(Transaction *t) {
+    return ledger_insert(t) >= 0;
+}
+
+static int load_transactions_csv(const char *path) {
+    return scan_transactions_csv(path, load_csv_row) >= 0;
+}
+
+// Reads the manifest into lg->parts: 1 when loaded, -1 when there is none,
+// 0 when it exists but cannot be trusted.
+static int load_manifest(const char *path) {
+    size_t size;
+    unsigned char *base = map_file(path, &size);
+    if (!base) { struct stat st; return stat(path, &st) != 0 ? -1 : 0; }
+    stat_io(IO_SNAPSHOT, (int64_t)size, 0);
+    const ManifestHeader *h = (const ManifestHeader *)base;
+    const PartEntry *e = (const PartEntry *)(base + sizeof(*h));
+    int n = size >= sizeof(*h) ? (int)h->part_count : 0;
+    int ok = size >= sizeof(*h) && memcmp(h->magic, MANIFEST_MAGIC, 8) == 0 && h->version == MANIFEST_VERSION
+          && size == sizeof(*h) + (uint64_t)h->part_count * sizeof(PartEntry);
+    for (int i = 0; ok && i < n; ++i)
+        ok = e[i].year >= AGG_MIN_YEAR && e[i].year <= AGG_MAX_YEAR && (!i || e[i - 1].year < e[i].year);
+    if (ok && n > lg->part_cap) {
+        PartEntry *np = realloc(lg->parts, n * sizeof(PartEntry));
+        if ((ok = np != NULL)) { lg->parts = np; lg->part_cap = n; }
+    }
+    if (ok) {
+        memcpy(lg->parts, e, n * sizeof(PartEntry)); lg->part_count = n;
+        if (h->next_id > lg->next_id) lg->next_id = h->next_id;
+        lg->generation = h->generation;
+    }
+    unmap_file(base, size);
+    return ok;
+}
+
+// Brings one year's partition into memory. The flag goes up before the rows
+// go in, so ledger_insert does not come back here, and the rows read from
+// disk do not count as changes.
+static void part_load(int y) {
+    unsigned char *fl = &lg->part_flags[y - AGG_MIN_YEAR];
+    if (*fl & PART_LOADED) return;
+    *fl |= PART_LOADED;
+    if (*fl & PART_ROLLUP) { agg_reset_year(y - AGG_MIN_YEAR); *fl &= ~PART_ROLLUP; }  // the rows bring their own totals
+    if (part_index(y) < 0) return;
+    int64_t t0 = now_ns();
+    int dirty = *fl & PART_DIRTY;
+    char path[MAX_LINE]; ledger_part_path(lg->user, y, path, sizeof(path));
+    lg->date_index_ok = 0;  // one sort afterwards beats a memmove per row
+    if (!load_transactions_bin(path)) { *fl |= PART_BROKEN; report_bad_line(path, 0, "unreadable partition, not saved over"); }
+    *fl = (unsigned char)((*fl & ~PART_DIRTY) | dirty);
+    stat_time(OP_PART_LOAD, t0);
+}
+
+static void ledger_sync(void);  // with the session helpers
+
+// Loads every year lo..hi not yet in memory. Partition files only change
+// together with the manifest, under the exclusive lock; if the manifest moved
+// since this ledger read it, the whole ledger is reloaded first. That renumbers
+// slots, so callers fault in before they hold any (under a lock nothing moves).
+static void part_fault(int lo, int hi) {
+    ledger_lock(0);
+    if (lg->lock_depth == 1) {
+        char path[MAX_LINE]; FileSig sig;
+        ledger_manifest_path(lg->user, path, sizeof(path)); file_sig(path, &sig);
+        if (memcmp(&sig, &lg->snap, sizeof(sig)) != 0) ledger_sync();
+    }
+    for (int i = 0; i < lg->part_count; ++i) if (lg->parts[i].year >= lo && lg->parts[i].year <= hi) part_load(lg->parts[i].year);
+    for (int y = lo; y <= hi; ++y) lg->part_flags[y - AGG_MIN_YEAR] |= PART_LOADED;
+    ledger_unlock();
+}
+
+// For whole-history work (search, export, reports over a date range).
+static void ledger_need_years(int lo, int hi) {
+    if (lo < AGG_MIN_YEAR) lo = AGG_MIN_YEAR;
+    if (hi > AGG_MAX_YEAR) hi = AGG_MAX_YEAR;
+    for (int i = 0; i < lg->part_count; ++i)
+        if (lg->parts[i].year >= lo && lg->parts[i].year <= hi && !(lg->part_flags[lg->parts[i].year - AGG_MIN_YEAR] & PART_LOADED)) {
+            part_fault(lo, hi); return;
+        }
+}
+
+static int part_fault_id(int id) {
+    int hit = 0;
+    for (int i = 0; i < lg->part_count; ++i) {
+        const PartEntry *e = &lg->parts[i];
+        if (id < e->min_id || id > e->max_id || (lg->part_flags[e->year - AGG_MIN_YEAR] & PART_LOADED)) continue;
+        part_fault(e->year, e->year); hit = 1;
+        i = -1;  // a reload may have replaced the list; start over, loaded years are skipped
+    }
+    return hit;
+}
+
+// ---- Rollup ------------------------------------------------------------------
+// Month and category totals of the partitions persist in user_<name>_rollup.bin,
+// stamped with the manifest generation they were computed from. A login that
+// finds a matching rollup answers the dashboard and every summary without
+// reading a row; any other rollup is rebuilt from the partition files.
+
+// Totals of one partition straight from its mapped columns; the rows stay on disk.
+static int part_rollup(int y) {
+    char path[MAX_LINE]; ledger_part_path(lg->user, y, path, sizeof(path));
+    size_t size;
+    unsigned char *base = ledger_file_map(path, &size);
+    if (!base) return 0;
+    const LedgerFileHeader *h = (const LedgerFileHeader *)base;
+    const uint32_t *dates = (const uint32_t *)(base + h->off_dates), *cat_offs = (const uint32_t *)(base + h->off_cat_offs);
+    const uint16_t *catx = (const uint16_t *)(base + h->off_cats);
+    const uint8_t *types = base + h->off_types;
+    const int64_t *amounts = (const int64_t *)(base + h->off_amounts);
+    const char *names = (const char *)base + h->off_cat_names;
+    int *remap = malloc((h->cat_count + 1) * sizeof(int)), ok = remap != NULL;
+    for (uint32_t c = 0; ok && c < h->cat_count; ++c) remap[c] = -1;
+    for (uint32_t i = 0; ok && i < h->count; ++i) {
+        int c = catx[i], type = types[i] ? TXN_EXPENSE : TXN_INCOME;
+        if (remap[c] < 0 && (remap[c] = cat_intern(names + cat_offs[c], cat_offs[c + 1] - cat_offs[c], type)) < 0) ok = 0;
+        else agg_add(dates[i] / 100 % 100, (int)(dates[i] / 10000), type, remap[c], amounts[i], +1);
+    }
+    free(remap);
+    unmap_file(base, size);
+    return ok;
+}
+
+// Only a rollup covering every partition is worth writing.
+static int save_rollup(const char *username) {
+    int years = 0, cells = 0;
+    for (int i = 0; i < lg->part_count; ++i) {
+        int y = lg->parts[i].year;
+        if (!(lg->part_flags[y - AGG_MIN_YEAR] & (PART_LOADED | PART_ROLLUP)) || (lg->part_flags[y - AGG_MIN_YEAR] & PART_BROKEN)) return 0;
+        CatYear *cy = lg->cat_aggs[y - AGG_MIN_YEAR];
+        for (int k = 0; cy && k < cy->cap * 12; ++k) if (cy->cells[k].count) cells++;
+        years++;
+    }
+    char path[MAX_LINE], tmp[MAX_LINE + 32]; rollup_path(username, path, sizeof(path));
+    FILE *f = atomic_begin(path, tmp, sizeof(tmp));
+    if (!f) return 0;
+    RollupHeader h; memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ROLLUP_MAGIC, 8);
+    h.version = ROLLUP_VERSION; h.generation = lg->generation; h.manifest = lg->snap;
+    h.cat_count = (uint32_t)lg->cat_count; h.year_count = (uint32_t)years; h.cell_count = (uint32_t)cells;
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 && (!lg->cat_count || fwrite(lg->cats, sizeof(Category), lg->cat_count, f) == (size_t)lg->cat_count);
+    for (int i = 0; ok && i < lg->part_count; ++i) {
+        RollupYear ry; memset(&ry, 0, sizeof(ry));
+        ry.year = lg->parts[i].year;
+        if (lg->month_aggs[ry.year - AGG_MIN_YEAR]) memcpy(ry.months, lg->month_aggs[ry.year - AGG_MIN_YEAR], sizeof(ry.months));
+        ok = fwrite(&ry, sizeof(ry), 1, f) == 1;
+    }
+    for (int i = 0; ok && i < lg->part_count; ++i) {
+        int y = lg->parts[i].year;
+        CatYear *cy = lg->cat_aggs[y - AGG_MIN_YEAR];
+        for (int k = 0; ok && cy && k < cy->cap * 12; ++k) {
+            if (!cy->cells[k].count) continue;
+            RollupCell rc; memset(&rc, 0, sizeof(rc));
+            rc.year = y; rc.cat = (uint16_t)(k / 12); rc.month = (uint8_t)(k % 12 + 1); rc.cell = cy->cells[k];
+            ok = fwrite(&rc, sizeof(rc), 1, f) == 1;
+        }
+    }
+    return atomic_commit(f, tmp, path, ok, IO_ROLLUP);
+}
+
+// Seeds the totals of every partition year from a rollup of the current
+// manifest; 0 (and nothing seeded) for a missing, stale or damaged file.
+static int load_rollup(const char *username) {
+    char path[MAX_LINE]; rollup_path(username, path, sizeof(path));
+    size_t size;
+    unsigned char *base = map_file(path, &size);
+    if (!base) return 0;
+    stat_io(IO_ROLLUP, (int64_t)size, 0);
+    const RollupHeader *h = (const RollupHeader *)base;
+    int ok = size >= sizeof(*h) && memcmp(h->magic, ROLLUP_MAGIC, 8) == 0 && h->version == ROLLUP_VERSION
+          && h->generation == lg->generation && memcmp(&h->manifest, &lg->snap, sizeof(lg->snap)) == 0 && h->year_count == (uint32_t)lg->part_count
+          && size == sizeof(*h) + (uint64_t)h->cat_count * sizeof(Category) + (uint64_t)h->year_count * sizeof(RollupYear)
+                     + (uint64_t)h->cell_count * sizeof(RollupCell);
+    const Category *cats = (const Category *)(base + sizeof(*h));
+    const RollupYear *ry = (const RollupYear *)(cats + (ok ? h->cat_count : 0));
+    const RollupCell *rc = (const RollupCell *)(ry + (ok ? h->year_count : 0));
+    for (uint32_t i = 0; ok && i < h->year_count; ++i) ok = ry[i].year == lg->parts[i].year;
+    for (uint32_t i = 0; ok && i < h->cell_count; ++i) ok = rc[i].cat < h->cat_count && rc[i].month >= 1 && rc[i].month <= 12;
+    int *remap = ok ? malloc((h->cat_count + 1) * sizeof(int)) : NULL;
+    for (uint32_t c = 0; remap && c < h->cat_count; ++c)
+        remap[c] = cat_intern(cats[c].name, strnlen(cats[c].name, sizeof(cats[c].name)), cats[c].kind);
+    if (remap) {
+        for (uint32_t i = 0; i < h->year_count; ++i) {
+            MonthAgg *a = month_agg(1, ry[i].year, 1);
+            if (a) { memcpy(a, ry[i].months, sizeof(ry[i].months)); lg->flow_tree_ok = 0; }
+            lg->part_flags[ry[i].year - AGG_MIN_YEAR] |= PART_ROLLUP;
+        }
+        for (uint32_t i = 0; i < h->cell_count; ++i) {
+            CatCell *c = remap[rc[i].cat] >= 0 ? cat_cell(rc[i].month, rc[i].year, remap[rc[i].cat], 1) : NULL;
+            if (c) { c->income += rc[i].cell.income; c->expense += rc[i].cell.expense; c->count += rc[i].cell.count; }
+        }
+    }
+    free(remap);
+    unmap_file(base, size);
+    return remap != NULL;
+}
+
+// The slow path: totals from every partition file, then a fresh rollup.
+static void rebuild_rollup(const char *username) {
+    int64_t t0 = now_ns();
+    for (int i = 0; i < lg->part_count; ++i) {
+        int y = lg->parts[i].year;
+        if (!(lg->part_flags[y - AGG_MIN_YEAR] & (PART_LOADED | PART_ROLLUP)) && part_rollup(y))
+            lg->part_flags[y - AGG_MIN_YEAR] |= PART_ROLLUP;
+    }
+    save_rollup(username);
+    stat_time(OP_ROLLUP, t0);
+}
+
+// Nothing in a pre-partition file has a partition yet: every year counts as
+// loaded, and the years that get rows are written out at the next save.
+static void load_legacy_transactions(const char *username) {
+    char path[MAX_LINE]; ledger_bin_path(username, path, sizeof(path));
+    memset(lg->part_flags, PART_LOADED, sizeof(lg->part_flags));
+    lg->legacy_snapshot = 1;
+    if (load_transactions_bin(path)) return;
+    ledger_reset();
+    memset(lg->part_flags, PART_LOADED, sizeof(lg->part_flags));
+    lg->legacy_snapshot = 1;
+    txns_path(username, path, sizeof(path));
+    load_transactions_csv(path);
+    stat_io(IO_SNAPSHOT, file_size_of(path), 0);
+}
+
+// The manifest is authoritative. Login reads it and the rollup, so no rows
+// at all; a year's rows are faulted in when a search, export or change
+// reaches them.
+// A ledger still in the single-file snapshot or the legacy CSV is read whole
+// and split into partitions at the next save.
+static void load_transactions_for_user(const char *username) {
+    int64_t t0 = now_ns();
+    ledger_lock(0);
+    ledger_reset();
+    load_bad_lines = 0;
+    if (lg->journal_fp) { fclose(lg->journal_fp); lg->journal_fp = NULL; }
+    char path[MAX_LINE]; ledger_manifest_path(username, path, sizeof(path));
+    file_sig(path, &lg->snap);
+    int rc = load_manifest(path);
+    if (rc > 0) { if (!load_rollup(username)) rebuild_rollup(username); }
+    else if (rc == 0) {
+        report_bad_line(path, 0, "unreadable manifest, ledger is read-only");
+        memset(lg->part_flags, PART_LOADED | PART_BROKEN, sizeof(lg->part_flags));
+    } else load_legacy_transactions(username);
+    replay_journal_for_user(username, 0);
+    if (interactive_session) {  // the dashboard and new entries mostly land in this year
+        int d, m, y; today(&d, &m, &y);
+        ledger_need_year(y);
+        text_index_ensure();
+    }
+    ledger_unlock();
+    stat_time(OP_LOAD, t0);
+}
+
+static int export_transactions_csv(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    ledger_need_years(AGG_MIN_YEAR, AGG_MAX_YEAR);
+    int64_t t0 = now_ns();
+    int n = 0;
+    fprintf(f, "#next_id,%d\n", lg->next_id);
+    for (int i = 0; i < lg->txn_slots; ++i) {
+        Transaction t;
+        if (!txn_id(i)) continue;
+        txn_load(i, &t); write_txn_row(f, &t); n++;
+    }
+    stat_io(IO_EXPORT, 0, ftell(f));
+    fclose(f);
+    stat_time(OP_EXPORT, t0);
+    return n;
+}
+
+static int batch_push(TxnBatch *b, const Transaction *t, long line_no) {
+    if (b->count == b->cap) {
+        int ncap = b->cap ? b->cap * 2 : 1024;
+        Transaction *nr = realloc(b->rows, ncap * sizeof(*nr));
+        if (nr) b->rows = nr;
+        long *nl = realloc(b->line_no, ncap * sizeof(*nl));
+        if (nl) b->line_no = nl;
+        const char **nw = realloc(b->why, ncap * sizeof(*nw));
+        if (nw) b->why = nw;
+        if (!nr || !nl || !nw) return 0;
+        b->cap = ncap;
+    }
+    b->rows[b->count] = *t;
+    b->line_no[b->count] = line_no;
+    b->why[b->count++] = NULL;
+    return 1;
+}
+
+static void batch_free(TxnBatch *b) {
+    free(b->rows); free(b->line_no); free(b->why);
+    memset(b, 0, sizeof(*b));
+}
+
+// Validates and inserts a whole batch with the same rules as the add screen.
+// Each accepted row updates the month aggregates, so later rows are checked
+// against everything before them at O(1) per row. Incomes go first so a
+// month's salary counts before that month's expenses regardless of file
+// order; IDs still follow file order, and rejected rows do not use one up.
+// Nothing is written to disk here.
+static int ledger_insert_batch(TxnBatch *b, int flags) {
+    int base = next_txn_id();
+    b->accepted = b->over_budget = 0;
+    lg->date_index_ok = 0;  // one sort afterwards beats a memmove per row
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < b->count; ++i) {
+            Transaction *t = &b->rows[i];
+            if (t->type != (pass ? TXN_EXPENSE : TXN_INCOME)) continue;
+            t->id = base + i;
+            int warn = txn_check(t, &b->why[i]);
+            if (warn >= 0 && (warn & TXN_WARN_OVER_INCOME) && !(flags & IMPORT_ALLOW_OVER_INCOME)) {
+                b->why[i] = "expense exceeds income for the month"; warn = -1;
+            }
+            if (warn >= 0 && ledger_insert(t) < 0) { b->why[i] = "out of memory"; warn = -1; }
+            if (warn < 0) { t->id = 0; continue; }
+            b->accepted++;
+            if (warn & TXN_WARN_OVER_BUDGET) b->over_budget++;
+        }
+    }
+    // Rows went in under base + file index; close the gaps left by rejects. An
+    // accepted row only moves down, onto an ID no earlier row holds any more.
+    for (int i = 0, k = 0; i < b->count; ++i) {
+        Transaction *t = &b->rows[i];
+        if (!t->id) continue;
+        int id = base + k++;
+        if (t->id == id) continue;
+        int pos = id_index_find(t->id), slot = lg->id_index[pos] - 1;
+        lg->id_index[pos] = -1;
+        txn_page(slot)->id[slot & TXN_PAGE_MASK] = t->id = id;
+        id_index_put(id, slot);
+    }
+    lg->next_id = base + b->accepted;
+    return b->accepted;
+}
+
+static THREAD_LOCAL TxnBatch *scan_batch = NULL;
+
+static int batch_csv_row(Transaction *t) { return batch_push(scan_batch, t, scan_line_no); }
+
+// Parses the whole file, applies it as one batch and commits the accepted
+// rows with a single journal write (or leaves that to the caller's snapshot).
+// Returns the number accepted, or -1 if the file cannot be read.
+static int import_transactions_csv(const char *path, int flags, TxnBatch *b) {
+    int64_t t0 = now_ns();
+    load_bad_lines = 0;
+    memset(b, 0, sizeof(*b));
+    ledger_begin_write();  // held across parse and insert: rows carry category ids
+    int saved_next = lg->next_id;
+    scan_batch = b;
+    int n = scan_transactions_csv(path, batch_csv_row);
+    scan_batch = NULL;
+    lg->next_id = saved_next;  // an imported file's #next_id hint is not ours to trust
+    if (n < 0) { ledger_unlock(); return -1; }
+    stat_io(IO_IMPORT, file_size_of(path), 0);
+    ledger_insert_batch(b, flags);
+    if (!(flags & IMPORT_NO_JOURNAL)) journal_append_batch(b);
+    ledger_unlock();
+    stat_time(OP_IMPORT, t0);
+    return b->accepted;
+}
+
+static int ob_open(OutBuf *o, const char *path) {
+    memset(o, 0, sizeof(*o));
+    if (!(o->f = fopen(path, "wb"))) return 0;
+    if (!(o->buf = malloc(REPORT_BUF))) { fclose(o->f); return 0; }
+    setvbuf(o->f, NULL, _IONBF, 0);  // we already buffer; skip the second copy
+    o->cap = REPORT_BUF;
+    return 1;
+}
+
+static void ob_flush(OutBuf *o) {
+    if (o->len && fwrite(o->buf, 1, o->len, o->f) != o->len) o->err = 1;
+    o->written += o->len;
+    o->len = 0;
+}
+
+static int ob_close(OutBuf *o) {
+    ob_flush(o);
+    if (fclose(o->f) != 0) o->err = 1;
+    stat_io(IO_EXPORT, 0, o->written);
+    free(o->buf);
+    return !o->err;
+}
+
+static void ob_put(OutBuf *o, const char *p, size_t n) {
+    if (o->len + n > o->cap) ob_flush(o);
+    if (n > o->cap) { if (fwrite(p, 1, n, o->f) != n) o->err = 1; o->written += n; return; }
+    memcpy(o->buf + o->len, p, n); o->len += n;
+}
+
+static void ob_puts(OutBuf *o, const char *s) { ob_put(o, s, strlen(s)); }
+
+static void ob_char(OutBuf *o, char c) {
+    if (o->len == o->cap) ob_flush(o);
+    o->buf[o->len++] = c;
+}
+
+static void ob_fill(OutBuf *o, char c, int n) { while (n-- > 0) ob_char(o, c); }
+
+// Left-aligned in a field of width (like %-Ns), cut at max bytes when max >= 0.
+static void ob_field(OutBuf *o, const char *s, int width, int max) {
+    size_t n = strlen(s);
+    if (max >= 0 && n > (size_t)max) n = max;
+    ob_put(o, s, n); ob_fill(o, ' ', width - (int)n);
+}
+
+// Digits of v, right-aligned to width, zero- or space-padded.
+static void ob_int(OutBuf *o, int64_t v, int width, char pad) {
+    char tmp[24]; int n = 0, neg = v < 0;
+    uint64_t u = neg ? -(uint64_t)v : (uint64_t)v;
+    do { tmp[sizeof(tmp) - 1 - n++] = (char)('0' + u % 10); u /= 10; } while (u);
+    if (neg && pad == ' ') tmp[sizeof(tmp) - 1 - n++] = '-';
+    if (neg && pad == '0') { ob_char(o, '-'); width--; }
+    ob_fill(o, pad, width - n);
+    ob_put(o, tmp + sizeof(tmp) - n, n);
+}
+
+// Right-aligned like %W.2f.
+static void ob_money(OutBuf *o, int64_t paise, int width) {
+    char tmp[32]; int n = format_paise(tmp + 32, paise);
+    ob_fill(o, ' ', width - n);
+    ob_put(o, tmp + 32 - n, n);
+}
+
+static void ob_date(OutBuf *o, int packed) {
+    ob_int(o, packed % 100, 2, '0'); ob_char(o, '/');
+    ob_int(o, packed / 100 % 100, 2, '0'); ob_char(o, '/');
+    ob_int(o, packed / 10000, 4, '0');
+}
+
+// Same rule as write_txn_row: commas become semicolons so a field stays one CSV column.
+static void ob_csv_str(OutBuf *o, const char *s) {
+    for (; *s; ++s) ob_char(o, *s == ',' ? ';' : *s);
+}
+
+static void ob_json_str(OutBuf *o, const char *s) {
+    ob_char(o, '"');
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') { ob_char(o, '\\'); ob_char(o, (char)c); }
+        else if (c < 0x20) { static const char hex[] = "0123456789abcdef"; ob_puts(o, "\\u00"); ob_char(o, hex[c >> 4]); ob_char(o, hex[c & 15]); }
+        else ob_char(o, (char)c);
+    }
+    ob_char(o, '"');
+}
+
+static const char *report_ext(int fmt) { return fmt == REPORT_CSV ? "csv" : fmt == REPORT_JSONL ? "jsonl" : "txt"; }
+
+// balance is the running balance after this row.
+static void report_row(OutBuf *o, int fmt, const Transaction *t, int64_t paise, int64_t balance) {
+    int date = (int)pack_date(t->day, t->month, t->year);
+    if (fmt == REPORT_CSV) {
+        ob_int(o, t->id, 0, ' '); ob_char(o, ',');
+        ob_date(o, date); ob_char(o, ',');
+        ob_puts(o, txn_type_name(t->type)); ob_char(o, ',');
+        ob_csv_str(o, cat_name(t->cat)); ob_char(o, ',');
+        ob_money(o, paise, 0); ob_char(o, ',');
+        ob_money(o, balance, 0); ob_char(o, ',');
+        ob_csv_str(o, t->note); ob_char(o, '\n');
+    } else if (fmt == REPORT_JSONL) {
+        ob_puts(o, "{\"record\":\"txn\",\"id\":"); ob_int(o, t->id, 0, ' ');
+        ob_puts(o, ",\"date\":\""); ob_int(o, t->year, 4, '0'); ob_char(o, '-'); ob_int(o, t->month, 2, '0'); ob_char(o, '-'); ob_int(o, t->day, 2, '0');
+        ob_puts(o, "\",\"type\":\""); ob_puts(o, txn_type_name(t->type));
+        ob_puts(o, "\",\"category\":"); ob_json_str(o, cat_name(t->cat));
+        ob_puts(o, ",\"amount\":"); ob_money(o, paise, 0);
+        ob_puts(o, ",\"balance\":"); ob_money(o, balance, 0);
+        ob_puts(o, ",\"note\":"); ob_json_str(o, t->note); ob_puts(o, "}\n");
+    } else {
+        ob_int(o, t->id, 4, ' '); ob_puts(o, " | ");
+        ob_date(o, date); ob_puts(o, " | ");
+        ob_field(o, txn_type_name(t->type), 8, -1); ob_puts(o, " | ");
+        ob_field(o, cat_name(t->cat), 18, -1); ob_puts(o, " | ");
+        ob_money(o, paise, 11); ob_puts(o, " | ");
+        ob_money(o, balance, 13); ob_puts(o, " | ");
+        ob_field(o, t->note, 0, 30); ob_char(o, '\n');
+    }
+}
+
+static void report_group_line(OutBuf *o, int fmt, const char *kind, const char *key, long count, int64_t inc, int64_t exp) {
+    if (fmt == REPORT_CSV) {
+        ob_csv_str(o, key); ob_char(o, ','); ob_int(o, count, 0, ' '); ob_char(o, ',');
+        ob_money(o, inc, 0); ob_char(o, ','); ob_money(o, exp, 0); ob_char(o, ','); ob_money(o, inc - exp, 0); ob_char(o, '\n');
+    } else if (fmt == REPORT_JSONL) {
+        ob_puts(o, "{\"record\":\""); ob_puts(o, kind); ob_puts(o, "\",\"key\":"); ob_json_str(o, key);
+        ob_puts(o, ",\"count\":"); ob_int(o, count, 0, ' ');
+        ob_puts(o, ",\"income\":"); ob_money(o, inc, 0); ob_puts(o, ",\"expense\":"); ob_money(o, exp, 0);
+        ob_puts(o, ",\"net\":"); ob_money(o, inc - exp, 0); ob_puts(o, "}\n");
+    } else {
+        ob_field(o, key, 20, -1); ob_int(o, count, 8, ' ');
+        ob_money(o, inc, 14); ob_money(o, exp, 14); ob_money(o, inc - exp, 14); ob_char(o, '\n');
+    }
+}
+
+static void report_banner(OutBuf *o, const char *kind, const char *title) {
+    ob_fill(o, '=', 80); ob_char(o, '\n');
+    ob_fill(o, ' ', 22); ob_puts(o, kind); ob_puts(o, title); ob_char(o, '\n');
+    ob_fill(o, ' ', 29); ob_puts(o, "User: "); ob_puts(o, lg->user); ob_char(o, '\n');
+    ob_fill(o, '=', 80); ob_char(o, '\n');
+}
+
+static void report_total(OutBuf *o, int fmt, const char *title, const ReportTotals *tot) {
+    if (fmt == REPORT_JSONL) report_group_line(o, fmt, "total", title, tot->rows, tot->income, tot->expense);
+    else if (fmt == REPORT_CSV) { ob_puts(o, "\nTotal,Count,Income,Expense,Net\n"); report_group_line(o, fmt, "total", "All", tot->rows, tot->income, tot->expense); }
+    else {
+        ob_fill(o, '-', 80); ob_char(o, '\n');
+        ob_puts(o, "TOTAL INCOME:                                                 "); ob_money(o, tot->income, 11); ob_char(o, '\n');
+        ob_puts(o, "TOTAL EXPENSE:                                                "); ob_money(o, tot->expense, 11); ob_char(o, '\n');
+        ob_puts(o, "NET BALANCE:                                                  "); ob_money(o, tot->income - tot->expense, 11); ob_char(o, '\n');
+    }
+}
+
+static void report_group_header(OutBuf *o, int fmt, const char *title, const char *key) {
+    if (fmt == REPORT_JSONL) return;
+    if (fmt == REPORT_CSV) { ob_char(o, '\n'); ob_puts(o, key); ob_puts(o, ",Count,Income,Expense,Net\n"); return; }
+    ob_puts(o, "\n"); ob_puts(o, title); ob_char(o, '\n');
+    ob_field(o, key, 20, -1); ob_puts(o, "   Count        Income       Expense           Net\n");
+    ob_fill(o, '-', 80); ob_char(o, '\n');
+}
+
+// Writes every transaction dated lo..hi (packed) in date order, then per-month
+// and per-category subtotals. Rows come off the date index, so months arrive
+// contiguously and both groupings fill in during the same pass. Each row
+// carries the running balance, opening with everything dated before lo.
+static int write_report(const char *path, int fmt, int lo, int hi, const char *title, ReportTotals *tot) {
+    int64_t t0 = now_ns();
+    OutBuf ob, *o = &ob;
+    memset(tot, 0, sizeof(*tot));
+    // Fault in before sizing the category arrays: a loaded year can bring new
+    // categories. The balance goes first, as its own faults rebuild the date index.
+    int64_t balance = flow_before(lo);
+    int first, end = date_index_range(lo, hi, &first);
+    int64_t *cat_inc = calloc(lg->cat_count ? lg->cat_count : 1, sizeof(int64_t));
+    int64_t *cat_exp = calloc(lg->cat_count ? lg->cat_count : 1, sizeof(int64_t));
+    long *cat_n = calloc(lg->cat_count ? lg->cat_count : 1, sizeof(long));
+    MonthTotal *months = NULL; int month_n = 0, month_cap = 0;
+    if (!cat_inc || !cat_exp || !cat_n || !ob_open(o, path)) { free(cat_inc); free(cat_exp); free(cat_n); return 0; }
+
+    if (fmt == REPORT_TXT) {
+        report_banner(o, "FINANCIAL REPORT: ", title);
+        ob_puts(o, "  ID | DATE       | TYPE     | CATEGORY           | AMOUNT (Rs) |  BALANCE (Rs) | NOTE\n");
+        ob_fill(o, '-', 80); ob_char(o, '\n');
+    } else if (fmt == REPORT_CSV) ob_puts(o, "ID,Date,Type,Category,Amount,Balance,Note\n");
+
+    for (int k = first; k < end; ++k) {
+        Transaction t; txn_load(lg->date_index[k], &t);
+        int64_t paise = t.amount;
+        balance += t.type == TXN_INCOME ? paise : -paise;
+        report_row(o, fmt, &t, paise, balance);
+        int ym = t.year * 100 + t.month;
+        if (!month_n || months[month_n - 1].ym != ym) {
+            if (month_n == month_cap) {
+                int ncap = month_cap ? month_cap * 2 : 64;
+                MonthTotal *nm = realloc(months, ncap * sizeof(*nm));
+                if (!nm) { o->err = 1; break; }
+                months = nm; month_cap = ncap;
+            }
+            memset(&months[month_n], 0, sizeof(MonthTotal)); months[month_n++].ym = ym;
+        }
+        MonthTotal *mt = &months[month_n - 1];
+        mt->count++; cat_n[t.cat]++; tot->rows++;
+        if (t.type == TXN_INCOME) { mt->income += paise; cat_inc[t.cat] += paise; tot->income += paise; }
+        else { mt->expense += paise; cat_exp[t.cat] += paise; tot->expense += paise; }
+    }
+
+    if (fmt == REPORT_TXT) {
+        ob_fill(o, '-', 80); ob_char(o, '\n');
+        if (!tot->rows) { ob_fill(o, ' ', 29); ob_puts(o, "No transactions recorded for this period.\n"); }
+    }
+    if (tot->rows) {
+        char key[64];
+        report_group_header(o, fmt, "BY MONTH", "Month");
+        for (int i = 0; i < month_n; ++i) {
+            snprintf(key, sizeof(key), "%02d/%04d", months[i].ym % 100, months[i].ym / 100);
+            report_group_line(o, fmt, "month", key, months[i].count, months[i].income, months[i].expense);
+        }
+        report_group_header(o, fmt, "BY CATEGORY", "Category");
+        for (int c = 0; c < lg->cat_count; ++c)
+            if (cat_n[c]) report_group_line(o, fmt, "category", cat_name(c), cat_n[c], cat_inc[c], cat_exp[c]);
+        report_total(o, fmt, title, tot);
+    }
+    if (fmt == REPORT_TXT) { ob_fill(o, '=', 80); ob_char(o, '\n'); }
+
+    free(months); free(cat_inc); free(cat_exp); free(cat_n);
+    int ok = ob_close(o);
+    stat_time(OP_EXPORT, t0);
+    return ok;
+}
+
+// Spend by category for each month of year y, then the year's categories
+// ranked by spend. Everything comes off the category cube; no row is read.
+static int write_category_report(const char *path, int fmt, int y, ReportTotals *tot) {
+    int64_t t0 = now_ns();
+    OutBuf ob, *o = &ob;
+    memset(tot, 0, sizeof(*tot));
+    agg_need_year(y);
+    CatTotal *cats = malloc((lg->cat_count ? lg->cat_count : 1) * sizeof(CatTotal));
+    if (!cats || !ob_open(o, path)) { free(cats); return 0; }
+    char title[16], key[96]; snprintf(title, sizeof(title), "%04d", y);
+    if (fmt == REPORT_TXT) report_banner(o, "CATEGORY REPORT: ", title);
+    report_group_header(o, fmt, "BY CATEGORY AND MONTH", "Mo Category");
+    for (int m = 1; m <= 12; ++m) {
+        int n = cat_totals(y, m, m, cats);
+        for (int i = 0; i < n; ++i) {
+            if (fmt == REPORT_TXT) snprintf(key, sizeof(key), "%02d %s", m, cat_name(cats[i].cat));
+            else snprintf(key, sizeof(key), "%02d/%04d %s", m, y, cat_name(cats[i].cat));
+            report_group_line(o, fmt, "category_month", key, cats[i].count, cats[i].income, cats[i].expense);
+        }
+    }
+    int n = cat_totals(y, 1, 12, cats);
+    report_group_header(o, fmt, "TOP CATEGORIES", "Category");
+    for (int i = 0; i < n; ++i) {
+        report_group_line(o, fmt, "category", cat_name(cats[i].cat), cats[i].count, cats[i].income, cats[i].expense);
+        tot->rows += cats[i].count; tot->income += cats[i].income; tot->expense += cats[i].expense;
+    }
+    if (n) report_total(o, fmt, title, tot);
+    else if (fmt == REPORT_TXT) { ob_fill(o, ' ', 29); ob_puts(o, "No transactions recorded for this year.\n"); }
+    if (fmt == REPORT_TXT) { ob_fill(o, '=', 80); ob_char(o, '\n'); }
+    free(cats);
+    int ok = ob_close(o);
+    stat_time(OP_EXPORT, t0);
+    return ok;
+}
+
+static void fmt_ns(char *out, size_t sz, uint64_t ns) {
+    if (ns < 1000) snprintf(out, sz, "%lluns", (unsigned long long)ns);
+    else if (ns < 1000000) snprintf(out, sz, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000) snprintf(out, sz, "%.1fms", ns / 1e6);
+    else snprintf(out, sz, "%.2fs", ns / 1e9);
+}
+
+static void fmt_bytes(char *out, size_t sz, uint64_t n) {
+    if (n < 1024) snprintf(out, sz, "%lluB", (unsigned long long)n);
+    else if (n < 1048576) snprintf(out, sz, "%.1fKB", n / 1024.0);
+    else if (n < 1073741824) snprintf(out, sz, "%.1fMB", n / 1048576.0);
+    else snprintf(out, sz, "%.2fGB", n / 1073741824.0);
+}
+
+// Upper edge of the histogram bucket holding the pct-th percentile call.
+static uint64_t stat_percentile(const OpStat *s, uint64_t calls, int pct) {
+    uint64_t want = (calls * pct + 99) / 100, seen = 0;
+    uint64_t max = STAT_GET(s->max_ns);
+    for (int b = 0; b < STAT_BUCKETS; ++b)
+        if ((seen += STAT_GET(s->hist[b])) >= want) return ((uint64_t)2 << b) < max ? (uint64_t)2 << b : max;
+    return max;
 }
 
-static int user_exists(const char *username) {
-    FILE *f = fopen(USERS_CSV, "r");
-    if (!f) return 0;
-    char line[MAX_LINE];
-    while (fgets(line, sizeof(line), f)) {
-        char u[64];
-        if (sscanf(line, "%63[^,],%*[^\n]", u) == 1) {
-            if (strcmp(u, username) == 0) { fclose(f); return 1; }
+// Hands the diagnostics out a line at a time (at most 66 columns, so they fit
+// the container); with histograms, each operation's non-empty buckets follow.
+static void stats_lines(void (*out)(const char *line, void *ctx), void *ctx, int histograms) {
+    char line[160], a[16], b[16], c[16], d[16];
+    if (stats_reset_at) {
+        struct tm tm;  // daemon workers get here concurrently
+#ifdef _WIN32
+        localtime_s(&tm, &stats_reset_at);
+#else
+        localtime_r(&stats_reset_at, &tm);
+#endif
+        snprintf(line, sizeof(line), "Counters since reset at %02d:%02d:%02d (pid %ld)", tm.tm_hour, tm.tm_min, tm.tm_sec, (long)getpid());
+    } else snprintf(line, sizeof(line), "Counters since process start (pid %ld)", (long)getpid());
+    out(line, ctx);
+    out("", ctx);
+    out("operation          calls       avg       p50       p99       max", ctx);
+    for (int op = 0; op < OP_COUNT; ++op) {
+        const OpStat *st = &op_stats[op];
+        uint64_t calls = STAT_GET(st->calls);
+        if (!calls) { snprintf(line, sizeof(line), "%-15s %8d", op_names[op], 0); out(line, ctx); continue; }
+        fmt_ns(a, sizeof(a), STAT_GET(st->total_ns) / calls);
+        fmt_ns(b, sizeof(b), stat_percentile(st, calls, 50)); fmt_ns(c, sizeof(c), stat_percentile(st, calls, 99));
+        fmt_ns(d, sizeof(d), STAT_GET(st->max_ns));
+        snprintf(line, sizeof(line), "%-15s %8llu %9s %9s %9s %9s", op_names[op], (unsigned long long)calls, a, b, c, d);
+        out(line, ctx);
+    }
+    out("", ctx);
+    out("file              reads      read   writes   written  per write", ctx);
+    for (int io = 0; io < IO_COUNT; ++io) {
+        const IoStat *st = &io_stats[io];
+        uint64_t w = STAT_GET(st->writes), wb = STAT_GET(st->bytes_written);
+        fmt_bytes(a, sizeof(a), STAT_GET(st->bytes_read)); fmt_bytes(b, sizeof(b), wb); fmt_bytes(c, sizeof(c), w ? wb / w : 0);
+        snprintf(line, sizeof(line), "%-15s %7llu %9s %8llu %9s %10s", io_names[io],
+                 (unsigned long long)STAT_GET(st->reads), a, (unsigned long long)w, b, c);
+        out(line, ctx);
+    }
+    if (!histograms) return;
+    for (int op = 0; op < OP_COUNT; ++op) {
+        if (!STAT_GET(op_stats[op].calls)) continue;
+        out("", ctx);
+        snprintf(line, sizeof(line), "%s latency:", op_names[op]); out(line, ctx);
+        for (int k = 0; k < STAT_BUCKETS; ++k) {
+            uint64_t n = STAT_GET(op_stats[op].hist[k]);
+            if (!n) continue;
+            fmt_ns(a, sizeof(a), (uint64_t)1 << k); fmt_ns(b, sizeof(b), (uint64_t)2 << k);
+            snprintf(line, sizeof(line), "  %9s .. %-9s %10llu", a, b, (unsigned long long)n);
+            out(line, ctx);
         }
     }
-    fclose(f); return 0;
 }
 
-static int save_transactions_for_user(const char *username) {
-    char path[MAX_LINE]; txns_path(username, path, sizeof(path));
-    FILE *f = fopen(path, "w");
-    if (!f) return 0;
-    for (int i = 0; i < txn_count; ++i) {
-        Transaction *t = &txns[i];
-        // Ensure note does not contain commas by replacing with semi-colons (maintains CSV integrity)
-        char safe_note[192]; strncpy(safe_note, t->note, sizeof(safe_note)-1); safe_note[sizeof(safe_note)-1]='\0';
-        for (int j=0; safe_note[j]; ++j) if (safe_note[j] == ',') safe_note[j] = ';';
-        fprintf(f, "%d,%s,%s,%.2f,%02d/%02d/%04d,%s\n", 
-                t->id, t->type, t->category, t->amount, t->day, t->month, t->year, safe_note);
+static void stats_reset(void) {
+    for (int op = 0; op < OP_COUNT; ++op) {
+        STAT_SET(op_stats[op].calls, 0); STAT_SET(op_stats[op].total_ns, 0); STAT_SET(op_stats[op].max_ns, 0);
+        for (int k = 0; k < STAT_BUCKETS; ++k) STAT_SET(op_stats[op].hist[k], 0);
+    }
+    for (int io = 0; io < IO_COUNT; ++io) {
+        STAT_SET(io_stats[io].reads, 0); STAT_SET(io_stats[io].bytes_read, 0);
+        STAT_SET(io_stats[io].writes, 0); STAT_SET(io_stats[io].bytes_written, 0);
     }
-    fclose(f); return 1;
+    stats_reset_at = time(NULL);
 }
 
-static void load_transactions_for_user(const char *username) {
-    txn_count = 0;
-    char path[MAX_LINE]; txns_path(username, path, sizeof(path));
-    FILE *f = fopen(path, "r");
-    if (!f) return;
-    char line[MAX_LINE];
-    while (fgets(line, sizeof(line), f) && txn_count < MAX_TXNS) {
-        Transaction t; memset(&t, 0, sizeof(t));
-        if (sscanf(line, "%d,%11[^,],%63[^,],%lf,%d/%d/%d,%191[^\n]", 
-                   &t.id, t.type, t.category, &t.amount, 
-                   &t.day, &t.month, &t.year, t.note) == 8) {
-            txns[txn_count++] = t;
-        }
-    }
-    fclose(f);
+static void stats_line_to_file(const char *line, void *ctx) { fputs(line, (FILE *)ctx); fputc('\n', (FILE *)ctx); }
+
+static void stats_line_to_screen(const char *line, void *ctx) {
+    (void)ctx;
+    if (line[0]) print_left_in_container(line, C_RESET); else print_empty_line_in_container();
 }
 
 static void load_settings_for_user(const char *username) {
-    monthly_budget = 0.0;
+    lg->monthly_budget = 0;
     char path[MAX_LINE]; settings_path(username, path, sizeof(path));
     FILE *f = fopen(path, "r");
     if (!f) return;
     char line[MAX_LINE];
     while (fgets(line, sizeof(line), f)) {
-        if (sscanf(line, "budget:%lf", &monthly_budget) == 1) break;
+        if (strncmp(line, "budget:", 7) != 0) continue;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!parse_money(line + 7, &lg->monthly_budget)) lg->monthly_budget = 0;
+        break;
     }
+    stat_io(IO_SETTINGS, ftell(f), 0);
     fclose(f);
 }
 
 static void save_settings_for_user(const char *username) {
-    char path[MAX_LINE]; settings_path(username, path, sizeof(path));
-    FILE *f = fopen(path, "w");
-    if (!f) return;
-    fprintf(f, "budget:%.2f\n", monthly_budget);
-    fclose(f);
+    char path[MAX_LINE], tmp[MAX_LINE + 32]; settings_path(username, path, sizeof(path));
+    ledger_lock(1);
+    FILE *f = atomic_begin(path, tmp, sizeof(tmp));
+    if (f) atomic_commit(f, tmp, path, fprintf(f, "budget:%s\n", money_str(lg->monthly_budget)) > 0, IO_SETTINGS);
+    ledger_unlock();
 }
 
-static double sum_income_month(int m, int y) {
-    double s = 0.0;
-    for (int i = 0; i < txn_count; ++i)
-        if (strcmp(txns[i].type, "Income") == 0 && txns[i].month == m && txns[i].year == y)
-            s += txns[i].amount;
-    return s;
+// Everything a session needs for lg->user, read under one shared lock.
+static void ledger_load_user(void) {
+    ledger_lock(0);
+    load_default_categories();
+    load_categories_for_user(lg->user);
+    load_transactions_for_user(lg->user);
+    load_settings_for_user(lg->user);
+    ledger_unlock();
 }
 
-static double sum_expense_month(int m, int y) {
-    double s = 0.0;
-    for (int i = 0; i < txn_count; ++i)
-        if (strcmp(txns[i].type, "Expense") == 0 && txns[i].month == m && txns[i].year == y)
-            s += txns[i].amount;
-    return s;
+// Whether another process committed something this ledger has not seen.
+static int ledger_stale(void) {
+    char path[MAX_LINE]; FileSig sig, j;
+    ledger_manifest_path(lg->user, path, sizeof(path)); file_sig(path, &sig);
+    if (memcmp(&sig, &lg->snap, sizeof(sig)) != 0) return 1;
+    journal_path(lg->user, path, sizeof(path)); file_sig(path, &j);
+    return j.size != lg->journal_pos;
 }
 
-static int salary_exists_in_month(int m, int y) {
-    for (int i = 0; i < txn_count; ++i)
-        if (strcmp(txns[i].type, "Income") == 0 && strcmp(txns[i].category, "Salary") == 0 && txns[i].month == m && txns[i].year == y)
-            return 1;
-    return 0;
+// Catches up with other sessions: a replaced manifest means they compacted,
+// so reload; a longer journal just replays the new tail. Caller holds the lock.
+static void ledger_sync(void) {
+    int64_t t0 = now_ns();
+    char path[MAX_LINE]; FileSig sig, j;
+    ledger_manifest_path(lg->user, path, sizeof(path)); file_sig(path, &sig);
+    journal_path(lg->user, path, sizeof(path)); file_sig(path, &j);
+    if (memcmp(&sig, &lg->snap, sizeof(sig)) != 0 || j.size < lg->journal_pos) {
+        int bad = load_bad_lines; char warn[sizeof(load_warning)]; memcpy(warn, load_warning, sizeof(warn));
+        ledger_load_user();
+        load_bad_lines = bad; memcpy(load_warning, warn, sizeof(warn));  // a reload is not a fresh login
+    } else if (j.size > lg->journal_pos) {
+        if (lg->journal_fp) fflush(lg->journal_fp);
+        replay_journal_for_user(lg->user, lg->journal_pos);
+    } else return;
+    stat_time(OP_SYNC, t0);
 }
 
-static Transaction* find_txn_by_id(int id) {
-    for (int i = 0; i < txn_count; ++i) if (txns[i].id == id) return &txns[i];
-    return NULL;
+// Exclusive lock plus catch-up; every ledger mutation that reaches disk runs
+// between this and ledger_unlock() so IDs and journal order stay consistent.
+static void ledger_begin_write(void) {
+    int outer = lg->lock_depth == 0;
+    ledger_lock(1);
+    if (outer) ledger_sync();
 }
 
-static int delete_txn_by_id(int id) {
-    int idx = -1;
-    for (int i = 0; i < txn_count; ++i) if (txns[i].id == id) { idx = i; break; }
-    if (idx == -1) return 0;
-    for (int j = idx; j < txn_count - 1; ++j) txns[j] = txns[j + 1];
-    txn_count--;
-    return 1;
+// For a transaction prepared before the lock: catch-up may have reloaded the
+// category dictionary, so its category is looked up again by name.
+static int ledger_begin_write_for(Transaction *t) {
+    char name[64]; strcpy(name, cat_name(t->cat));
+    ledger_begin_write();
+    return (t->cat = cat_intern(name, strlen(name), t->type)) >= 0;
+}
+
+// Cheap check before showing data; only takes the lock when something changed.
+static void ledger_refresh(void) {
+    if (!ledger_stale()) return;
+    ledger_lock(0);
+    ledger_sync();
+    ledger_unlock();
 }
 
 static void get_transaction_details(Transaction *t) {
     char tmp[64];
     get_input("Enter amount", tmp, sizeof(tmp)); 
-    t->amount = atof(tmp);
-    if (t->amount <= 0) { print_error("Invalid amount."); return; }
+    if (!parse_money(tmp, &t->amount) || t->amount <= 0) { t->amount = 0; print_error("Invalid amount."); return; }
     get_input("Enter note (optional)", t->note, sizeof(t->note));
 }
 
-void add_transaction_flow_with_month(int m_pref, int y_pref) {
-    if (txn_count >= MAX_TXNS) { print_error("Transaction limit reached."); wait_enter_center(); return; }
+static void txn_list_line(int slot, char *line, size_t sz, const char **color) {
+    Transaction rec, *t = &rec; txn_load(slot, t);
+    *color = (t->type == TXN_INCOME) ? C_GREEN : C_RED;
+    snprintf(line, sz, "ID:%d | %02d/%02d/%04d | %-8s | %-15s | %s | %s",
+             t->id, t->day, t->month, t->year, txn_type_name(t->type), cat_name(t->cat), money_str(t->amount), t->note[0]?t->note:"NA");
+}
+
+// Row i of a list view into line (at least 256 bytes); color defaults to C_RESET.
+typedef void (*ListRowFn)(void *ctx, int i, char *line, size_t sz, const char **color);
+
+// Paged list over total rows. Only the rows on the current page are ever
+// formatted, so total can run into the millions; each page is one frame.
+// Enter pages forward and leaves after the last page, so a short list behaves
+// like the old "press Enter to continue" screens.
+static void list_view(const char *title, int total, ListRowFn row, void *ctx) {
+    int pages = total ? (total + LIST_PAGE_ROWS - 1) / LIST_PAGE_ROWS : 1, page = 0;
+    char line[256], cmd[32];
+    while (1) {
+        print_header(title);
+        if (!total) print_centered_in_container("Nothing found.", C_RESET);
+        for (int i = page * LIST_PAGE_ROWS; i < total && i < (page + 1) * LIST_PAGE_ROWS; ++i) {
+            const char *color = C_RESET;
+            row(ctx, i, line, sizeof(line), &color);
+            line[CONTAINER_WIDTH - 3] = '\0';  // one screen line per row
+            print_left_in_container(line, color);
+        }
+        print_separator_in_container();
+        if (total) {
+            snprintf(line, sizeof(line), "Rows %d-%d of %d   Page %d/%d", page * LIST_PAGE_ROWS + 1,
+                     page + 1 < pages ? (page + 1) * LIST_PAGE_ROWS : total, total, page + 1, pages);
+            print_centered_in_container(line, C_YELLOW);
+        }
+        if (pages > 1) print_centered_in_container("Enter=next  p=prev  f=first  l=last  <n>=page  q=back", C_CYAN);
+        get_input(pages > 1 ? "Page" : "Press Enter to continue", cmd, sizeof(cmd));
+        if (cmd[0] == 'q' || cmd[0] == 'Q' || cmd[0] == '0') break;
+        if (!cmd[0]) { if (++page >= pages) break; }
+        else if (cmd[0] == 'p' || cmd[0] == 'P') { if (page) page--; }
+        else if (cmd[0] == 'f' || cmd[0] == 'F') page = 0;
+        else if (cmd[0] == 'l' || cmd[0] == 'L') page = pages - 1;
+        else if (atoi(cmd) >= 1) page = atoi(cmd) <= pages ? atoi(cmd) - 1 : pages - 1;
+    }
+    print_footer();
+}
 
+typedef struct {
+    int first;          // date index position of row 0
+} DateRangeRows;
+
+static void date_range_row(void *ctx, int i, char *line, size_t sz, const char **color) {
+    txn_list_line(lg->date_index[((DateRangeRows *)ctx)->first + i], line, sz, color);
+}
+
+// The live transactions dated lo..hi (packed), in date order, as a paged list.
+static void show_txns_in_range(const char *title, int lo, int hi) {
+    DateRangeRows r;
+    int end = date_index_range(lo, hi, &r.first);
+    list_view(title, end - r.first, date_range_row, &r);
+}
+
+// Rows of a slot map, newest first; deleted ones are skipped while building
+// the map, which costs one int per live row, not a formatted line.
+static void recent_row(void *ctx, int i, char *line, size_t sz, const char **color) {
+    txn_list_line(((int *)ctx)[i], line, sz, color);
+}
+
+// Slots hold rows in load order, and a year faulted in late lands after newer
+// ones, so newest means highest ID.
+static int txn_newest_cmp(const void *a, const void *b) {
+    int x = txn_id(*(const int *)a), y = txn_id(*(const int *)b);
+    return (x < y) - (x > y);
+}
+
+// The newest rows, at least a page of them. Partitions are faulted in by
+// descending ID range only until every row still on disk is older than the
+// ones collected; the list stops there rather than loading the whole history.
+static int recent_rows(int **out) {
+    int n, floor;
+    ledger_lock(0);  // nothing reloads between the faults and the row map
+    for (;;) {
+        int next = -1;
+        for (int i = 0; i < lg->part_count; ++i)
+            if (!(lg->part_flags[lg->parts[i].year - AGG_MIN_YEAR] & PART_LOADED) && (next < 0 || lg->parts[i].max_id > lg->parts[next].max_id)) next = i;
+        floor = next < 0 ? 0 : lg->parts[next].max_id;
+        n = 0;
+        for (int i = 0; i < lg->txn_slots; ++i) if (txn_id(i) > floor) n++;
+        if (next < 0 || n >= LIST_PAGE_ROWS) break;
+        part_fault(lg->parts[next].year, lg->parts[next].year);
+    }
+    int *rows = malloc((n ? n : 1) * sizeof(int));
+    n = 0;
+    for (int i = 0; rows && i < lg->txn_slots; ++i) if (txn_id(i) > floor) rows[n++] = i;
+    ledger_unlock();
+    if (rows) qsort(rows, n, sizeof(int), txn_newest_cmp);
+    *out = rows;
+    return rows ? n : -1;
+}
+
+void add_transaction_flow_with_month(int m_pref, int y_pref) {
     while (1) {
         print_header("ADD TRANSACTION");
         print_left_in_container("1) Add Income", C_RESET);
@@ -350,8 +3278,7 @@ void add_transaction_flow_with_month(int m_pref, int y_pref) {
 
         Transaction t; memset(&t,0,sizeof(t)); t.id = next_txn_id();
         int is_income = (ch[0] == '1');
-        strncpy(t.type, is_income ? "Income" : "Expense", sizeof(t.type)-1);
-        t.type[sizeof(t.type)-1] = '\0';
+        t.type = is_income ? TXN_INCOME : TXN_EXPENSE;
 
       char datebuf[16], tmp[64];
         if (m_pref && y_pref) {
@@ -371,12 +3298,10 @@ void add_transaction_flow_with_month(int m_pref, int y_pref) {
         if (sscanf(datebuf,"%d/%d/%d",&t.day,&t.month,&t.year) != 3) { print_error("Date processing error."); wait_enter_center(); continue; }
 
         print_centered_in_container(is_income ? "Choose income category:" : "Choose expense category:", C_RESET);
-        int sel_idxs[MAX_CATS], sel_count=0;
-        for (int i=0; i<cat_count; i++) {
-            int is_inc_cat = (strcasecmp(cats[i], "Salary")==0 || strcasecmp(cats[i], "Business")==0 || strcasecmp(cats[i], "Other Income")==0);
-            if (is_income == is_inc_cat) {
-                char b[80]; snprintf(b,sizeof(b), "%d) %s", sel_count+1, cats[i]); print_left_in_container(b, C_RESET);
-                sel_idxs[sel_count++] = i;
+        int sel_count=0;
+        for (int i=0; i<lg->cat_count; i++) {
+            if (lg->cats[i].kind == t.type) {
+                char b[80]; snprintf(b,sizeof(b), "%d) %s", ++sel_count, lg->cats[i].name); print_left_in_container(b, C_RESET);
             }
         }
         print_left_in_container("0) Custom", C_RESET);
@@ -384,11 +3309,12 @@ void add_transaction_flow_with_month(int m_pref, int y_pref) {
         int sel_idx = atoi(tmp);
 
         if (sel_idx == 0) {
-            get_input(is_income ? "Enter custom income category" : "Enter custom expense category", t.category, sizeof(t.category));
-            if (t.category[0]) add_category_session(t.category);
+            char name[64];
+            get_input(is_income ? "Enter custom income category" : "Enter custom expense category", name, sizeof(name));
+            if (!name[0]) { print_error("Category cannot be empty."); wait_enter_center(); continue; }
+            if ((t.cat = add_category(name, t.type)) < 0) { print_error("Too many categories."); wait_enter_center(); continue; }
         } else if (sel_idx > 0 && sel_idx <= sel_count) {
-            strncpy(t.category, cats[sel_idxs[sel_idx-1]], sizeof(t.category)-1);
-            t.category[sizeof(t.category)-1] = '\0';
+            for (int i = 0, k = 0; i < lg->cat_count; i++) if (lg->cats[i].kind == t.type && ++k == sel_idx) { t.cat = i; break; }
         } else {
             print_error("Invalid selection."); wait_enter_center(); continue;
         }
@@ -396,26 +3322,25 @@ void add_transaction_flow_with_month(int m_pref, int y_pref) {
         get_transaction_details(&t);
         if (t.amount <= 0) continue;
 
-        if (is_income && strcasecmp(t.category, "Salary") == 0 && salary_exists_in_month(t.month, t.year)) {
-            print_error("Salary already added for this month. Cannot add another.");
-            wait_enter_center(); continue;
-        }
-        if (!is_income) {
-            double inc = sum_income_month(t.month, t.year);
-            if (inc <= 0.0) { print_error("Cannot add expense: no income recorded for this month."); wait_enter_center(); continue; }
-            double ex_before = sum_expense_month(t.month, t.year);
-            if (ex_before + t.amount > inc) {
-                print_centered_in_container("Warning: Expense exceeds income for the month.", C_YELLOW);
-                get_input("Proceed? (Y/N)", tmp, sizeof(tmp));
-                if (!(tmp[0]=='Y' || tmp[0]=='y')) { print_error("Cancelled."); wait_enter_center(); continue; }
-            }
-            if (monthly_budget > 0.0 && ex_before + t.amount > monthly_budget) {
-                print_centered_in_container("Alert: Expense crosses monthly budget!", C_B_RED);
-            }
+        const char *why;
+        int warn = txn_check(&t, &why);
+        if (warn < 0) { print_error(why); wait_enter_center(); continue; }
+        if (warn & TXN_WARN_OVER_INCOME) {
+            print_centered_in_container("Warning: Expense exceeds income for the month.", C_YELLOW);
+            get_input("Proceed? (Y/N)", tmp, sizeof(tmp));
+            if (!(tmp[0]=='Y' || tmp[0]=='y')) { print_error("Cancelled."); wait_enter_center(); continue; }
+        }
+        if (warn & TXN_WARN_OVER_BUDGET) {
+            print_centered_in_container("Alert: Expense crosses monthly budget!", C_B_RED);
         }
 
-        txns[txn_count++] = t;
-        save_transactions_for_user(cur_user);
+        // other sessions may have written since the checks above: recheck under the lock
+        if (!ledger_begin_write_for(&t)) { ledger_unlock(); print_error("Too many categories."); wait_enter_center(); continue; }
+        t.id = next_txn_id();
+        if (txn_check(&t, &why) < 0) { ledger_unlock(); print_error(why); wait_enter_center(); continue; }
+        if (ledger_insert(&t) < 0) { ledger_unlock(); print_error("Out of memory."); wait_enter_center(); break; }
+        journal_append('A', &t);
+        ledger_unlock();
         print_success(is_income ? "Income added successfully." : "Expense added successfully.");
         wait_enter_center();
         break; 
@@ -441,11 +3366,10 @@ static void auth_menu(void) {
             get_input("Enter password", p, sizeof(p));
             welcome_animation(NULL);
             if (verify_user_file(u, p)) {
-                strncpy(cur_user, u, sizeof(cur_user)-1); cur_user[sizeof(cur_user)-1] = '\0';
-                load_default_categories();
-                load_transactions_for_user(cur_user);
-                load_settings_for_user(cur_user);
-                welcome_animation(cur_user);
+                strncpy(lg->user, u, sizeof(lg->user)-1); lg->user[sizeof(lg->user)-1] = '\0';
+                ledger_load_user();
+                welcome_animation(lg->user);
+                if (load_bad_lines) { show_load_warnings(); wait_enter_center(); }
                 return;
             } else {
                 print_error("Login failed. Invalid credentials.");
@@ -457,10 +3381,9 @@ static void auth_menu(void) {
             if (user_exists(u)) { print_error("Username already exists."); wait_enter_center(); continue; }
             get_input("Choose a password", p, sizeof(p));
             if (u[0] && p[0]) {
-                char enc[128]; strncpy(enc, p, sizeof(enc)-1); enc[sizeof(enc)-1] = '\0'; xor_str(enc);
-                FILE *f = fopen(USERS_CSV, "a");
-                if (f) {
-                    fprintf(f, "%s,%s\n", u, enc); fclose(f);
+                int r = user_register(u, p);
+                if (r == 0) print_error("Username already exists.");
+                else if (r > 0) {
                     char path[MAX_LINE];
                     txns_path(u, path, sizeof(path));
                     FILE *g = fopen(path, "w"); if (g) fclose(g);
@@ -481,6 +3404,7 @@ static void auth_menu(void) {
 
 void dashboard_menu(void) {
     while (1) {
+        ledger_refresh();
         print_header("DASHBOARD");
         print_left_in_container("1) View Month Summary", C_RESET);
         print_left_in_container("2) Add Transaction (for specific month)", C_RESET);
@@ -506,28 +3430,28 @@ void dashboard_menu(void) {
             if (buf[0] == '2') {
                 add_transaction_flow_with_month(m, y);
             } else {
-                double inc = sum_income_month(m, y);
-                double ex = sum_expense_month(m, y);
-                double net = inc - ex;
+                int64_t inc = sum_income_month(m, y);
+                int64_t ex = sum_expense_month(m, y);
+                int64_t net = inc - ex;
                 
                 char h_buf[128]; snprintf(h_buf, sizeof(h_buf), "Dashboard - %02d/%04d", m, y);
                 print_header(h_buf);
                 
                 char line[128];
-                snprintf(line, sizeof(line), "Income:   Rs. %10.2f", inc);
+                snprintf(line, sizeof(line), "Income:   Rs. %10s", money_str(inc));
                 print_centered_in_container(line, C_B_GREEN);
-                snprintf(line, sizeof(line), "Expenses: Rs. %10.2f", ex);
+                snprintf(line, sizeof(line), "Expenses: Rs. %10s", money_str(ex));
                 print_centered_in_container(line, C_B_RED);
-                snprintf(line, sizeof(line), "Net:      Rs. %10.2f", net);
+                snprintf(line, sizeof(line), "Net:      Rs. %10s", money_str(net));
                 print_centered_in_container(line, C_YELLOW);
                 print_separator_in_container();
 
-                if (monthly_budget > 0.0) {
-                    snprintf(line, sizeof(line), "Monthly Budget: Rs. %.2f", monthly_budget);
+                if (lg->monthly_budget > 0) {
+                    snprintf(line, sizeof(line), "Monthly Budget: Rs. %s", money_str(lg->monthly_budget));
                     print_centered_in_container(line, C_RESET);
-                    if (ex > monthly_budget) {
+                    if (ex > lg->monthly_budget) {
                         print_error("Alert: Expenses exceed monthly budget!");
-                    } else if (ex > monthly_budget * 0.8) {
+                    } else if (ex * 5 > lg->monthly_budget * 4) {  // over 80%
                         print_centered_in_container("Warning: Expenses approaching budget limit", C_YELLOW);
                     } else {
                         print_success("Within budget limits");
@@ -538,27 +3462,11 @@ void dashboard_menu(void) {
             }
         }
         else if (buf[0] == '3') {
-            print_header("RECENT TRANSACTIONS");
-            if (txn_count == 0) {
-                print_centered_in_container("No transactions recorded.", C_RESET);
-            } else {
-                int count = (txn_count < 10) ? txn_count : 10;
-                for (int i = txn_count - count; i < txn_count; ++i) {
-                    Transaction *t = &txns[i];
-                    char line[256];
-                    char* color = (strcmp(t->type, "Income") == 0) ? C_GREEN : C_RED;
-                    snprintf(line, sizeof(line), "ID:%d | %02d/%02d/%04d | %-8s | %-15s | %.2f | %s",
-                            t->id, t->day, t->month, t->year, 
-                            t->type, t->category, t->amount, 
-                            t->note[0] ? t->note : "NA");
-                    print_left_in_container(line, color);
-                }
-                char count_msg[64];
-                snprintf(count_msg, sizeof(count_msg), "Showing %d most recent transactions", count);
-                print_empty_line_in_container();
-                print_centered_in_container(count_msg, C_RESET);
-            }
-            wait_enter_center();
+            int *rows, n = recent_rows(&rows);
+            if (n < 0) { print_error("Out of memory."); wait_enter_center(); continue; }
+            list_view("RECENT TRANSACTIONS", n, recent_row, rows);
+            free(rows);
+            continue;
         }
         else {
             print_error("Invalid choice.");
@@ -568,12 +3476,683 @@ void dashboard_menu(void) {
     }
 }
 
-int main(void) {
+// ---- Command-line mode -----------------------------------------------------
+// budget <command> -u USER [-p PASS] [options]; the password may also come
+// from PF_PASSWORD. Plain text on stdout, errors on stderr, no prompts.
+// The daemon runs the same commands with both streams pointed at the client.
+
+static THREAD_LOCAL FILE *cli_out, *cli_err;
+
+static const char *cli_opt(int argc, char **argv, const char *name) {
+    for (int i = 2; i < argc - 1; ++i) if (strcmp(argv[i], name) == 0) return argv[i + 1];
+    return NULL;
+}
+
+static int cli_flag(int argc, char **argv, const char *name) {
+    for (int i = 2; i < argc; ++i) if (strcmp(argv[i], name) == 0) return 1;
+    return 0;
+}
+
+// First argument after the command that is neither an option nor an option's value.
+static const char *cli_arg(int argc, char **argv) {
+    for (int i = 2; i < argc; ++i) {
+        if (argv[i][0] != '-') return argv[i];
+        if (strcmp(argv[i], "--list") && strcmp(argv[i], "--force")) ++i;
+    }
+    return NULL;
+}
+
+// Packed date from DD/MM/YYYY, or def when the option was not given; -1 if malformed.
+static int cli_date(int argc, char **argv, const char *name, int def) {
+    const char *v = cli_opt(argc, argv, name);
+    if (!v) return def;
+    int d, m, y;
+    if (!is_valid_date(v) || sscanf(v, "%d/%d/%d", &d, &m, &y) != 3) { fprintf(cli_err, "invalid date for %s: %s\n", name, v); return -1; }
+    return (int)pack_date(d, m, y);
+}
+
+static void cli_usage(void) {
+    fprintf(cli_err,
+        "usage: budget <command> -u USER [-p PASS] [options]\n"
+        "  import FILE [--force]               bulk-load rows: id,type,category,amount,DD/MM/YYYY,note\n"
+        "  add --type income|expense --cat NAME --amount X [--date D] [--note TEXT] [--force]\n"
+        "  summary [--month M] [--year Y]      month totals, or every month of a year\n"
+        "  export FILE [--from D] [--to D] [--format txt|csv|jsonl]\n"
+        "  query [--from D] [--to D] [--type income|expense] [--cat A,B] [--list]\n"
+        "  stats [--histograms]                operation counts, latencies and file I/O of this process\n"
+        "  serve --socket PATH [--threads N]   keep ledgers resident and answer the commands above\n"
+        "  bench [--rows N | --max-rows N] [--out FILE]\n"
+        "                                      time the engine on synthetic ledgers of 1000 rows up to\n"
+        "                                      N (default 1000000) in powers of ten; JSON lines, no login\n"
+        "dates are DD/MM/YYYY; the password may be given in PF_PASSWORD instead of -p;\n"
+        "add --socket PATH to any command to run it in a daemon (file paths are relative to the daemon's directory)\n");
+}
+
+static int cli_login(int argc, char **argv) {
+    const char *u = cli_opt(argc, argv, "-u"), *p = cli_opt(argc, argv, "-p");
+    if (!p) p = getenv("PF_PASSWORD");
+    if (!u || !p) { cli_usage(); return 0; }
+    if (!verify_user_file(u, p)) { fprintf(cli_err, "login failed for %s\n", u); return 0; }
+    strncpy(lg->user, u, sizeof(lg->user)-1); lg->user[sizeof(lg->user)-1] = '\0';
+    ledger_load_user();
+    if (load_bad_lines) { fprintf(cli_err, "warning: skipped %d malformed line(s); first: %s\n", load_bad_lines, load_warning); load_bad_lines = 0; }
+    return 1;
+}
+
+static int cli_type(const char *v) {
+    if (!v) return -1;
+    if (strcasecmp(v, "income") == 0) return TXN_INCOME;
+    if (strcasecmp(v, "expense") == 0) return TXN_EXPENSE;
+    return -2;
+}
+
+// The whole file goes into memory first and is persisted with one snapshot
+// write, so there is no journal line per row.
+static int cli_import(int argc, char **argv) {
+    const char *path = cli_arg(argc, argv);
+    if (!path) { cli_usage(); return 1; }
+    TxnBatch b;
+    int flags = IMPORT_NO_JOURNAL | (cli_flag(argc, argv, "--force") ? IMPORT_ALLOW_OVER_INCOME : 0);
+    ledger_begin_write();  // nobody else may write between the import and its snapshot
+    int n = import_transactions_csv(path, flags, &b);
+    if (n < 0) { ledger_unlock(); fprintf(cli_err, "cannot open %s\n", path); return 3; }
+    if (load_bad_lines) fprintf(cli_err, "skipped %d malformed line(s); first: %s\n", load_bad_lines, load_warning);
+    for (int i = 0; i < b.count; ++i) if (b.why[i]) fprintf(cli_err, "%s:%ld: rejected: %s\n", path, b.line_no[i], b.why[i]);
+    int rejected = b.count - b.accepted, over = b.over_budget;
+    batch_free(&b);
+    int saved = !n || compact_transactions_for_user(lg->user);
+    ledger_unlock();
+    if (!saved) { fprintf(cli_err, "failed to save ledger\n"); return 3; }
+    fprintf(cli_out, "imported %d transaction(s), rejected %d\n", n, rejected);
+    if (over) fprintf(cli_out, "%d expense(s) cross the monthly budget\n", over);
+    return rejected ? 4 : 0;
+}
+
+static int cli_add(int argc, char **argv) {
+    Transaction t; memset(&t, 0, sizeof(t));
+    const char *cat = cli_opt(argc, argv, "--cat"), *amount = cli_opt(argc, argv, "--amount"), *note = cli_opt(argc, argv, "--note");
+    if ((t.type = cli_type(cli_opt(argc, argv, "--type"))) < 0 || !cat || !cat[0] || !amount) { cli_usage(); return 1; }
+    if (!parse_money(amount, &t.amount)) { fprintf(cli_err, "invalid amount: %s\n", amount); return 1; }
+    int td, tm, ty; today(&td, &tm, &ty);
+    int date = cli_date(argc, argv, "--date", (int)pack_date(td, tm, ty));
+    if (date < 0) return 1;
+    t.year = date / 10000; t.month = date / 100 % 100; t.day = date % 100;
+    if (note) { strncpy(t.note, note, sizeof(t.note)-1); t.note[sizeof(t.note)-1] = '\0'; }
+    ledger_begin_write();
+    int rc = 3;
+    if ((t.cat = add_category(cat, t.type)) < 0) { fprintf(cli_err, "too many categories\n"); goto out; }
+    const char *why;
+    int warn = txn_check(&t, &why);
+    if (warn < 0) { fprintf(cli_err, "%s\n", why); goto out; }
+    if ((warn & TXN_WARN_OVER_INCOME) && !cli_flag(argc, argv, "--force")) {
+        fprintf(cli_err, "Expense exceeds income for the month; pass --force to add it anyway.\n"); goto out;
+    }
+    if (warn & TXN_WARN_OVER_BUDGET) fprintf(cli_err, "Alert: Expense crosses monthly budget!\n");
+    t.id = next_txn_id();
+    if (ledger_insert(&t) < 0 || !journal_append('A', &t)) { fprintf(cli_err, "failed to record transaction\n"); goto out; }
+    fprintf(cli_out, "added %d\n", t.id);
+    rc = 0;
+out:
+    ledger_unlock();
+    return rc;
+}
+
+static int cli_summary(int argc, char **argv) {
+    const char *ms = cli_opt(argc, argv, "--month"), *ys = cli_opt(argc, argv, "--year");
+    int td, tm, ty; today(&td, &tm, &ty);
+    int y = ys ? atoi(ys) : ty;
+    int m = ms ? atoi(ms) : (ys ? 0 : tm);
+    if (y < AGG_MIN_YEAR || y > AGG_MAX_YEAR || m < 0 || m > 12) { fprintf(cli_err, "invalid month or year\n"); return 1; }
+    int64_t ti = 0, te = 0;
+    fprintf(cli_out, "month,income,expense,net\n");
+    for (int k = m ? m : 1; k <= (m ? m : 12); ++k) {
+        int64_t inc = sum_income_month(k, y), ex = sum_expense_month(k, y);
+        fprintf(cli_out, "%02d/%04d,%s,%s,%s\n", k, y, money_str(inc), money_str(ex), money_str(inc - ex));
+        ti += inc; te += ex;
+    }
+    if (!m) fprintf(cli_out, "total,%s,%s,%s\n", money_str(ti), money_str(te), money_str(ti - te));
+    if (m && lg->monthly_budget > 0) fprintf(cli_out, "budget,%s,remaining,%s\n", money_str(lg->monthly_budget), money_str(lg->monthly_budget - te));
+    return 0;
+}
+
+static int cli_export(int argc, char **argv) {
+    const char *path = cli_arg(argc, argv), *fs = cli_opt(argc, argv, "--format");
+    if (!path) { cli_usage(); return 1; }
+    int lo = cli_date(argc, argv, "--from", 0), hi = cli_date(argc, argv, "--to", (int)pack_date(99, 99, AGG_MAX_YEAR));
+    if (lo < 0 || hi < 0) return 1;
+    if (!fs) { fs = strrchr(path, '.'); fs = fs ? fs + 1 : "txt"; }
+    int fmt = strcasecmp(fs, "csv") == 0 ? REPORT_CSV : (strcasecmp(fs, "jsonl") == 0 || strcasecmp(fs, "json") == 0) ? REPORT_JSONL : REPORT_TXT;
+    const char *from = cli_opt(argc, argv, "--from"), *to = cli_opt(argc, argv, "--to");
+    char title[64] = "All transactions";
+    if (from || to) snprintf(title, sizeof(title), "%s - %s", from ? from : "start", to ? to : "end");
+    ReportTotals tot;
+    if (!write_report(path, fmt, lo, hi, title, &tot)) { fprintf(cli_err, "failed to write %s\n", path); return 3; }
+    fprintf(cli_out, "exported %ld transaction(s) to %s\n", tot.rows, path);
+    return 0;
+}
+
+static int cli_query(int argc, char **argv) {
+    RangeQuery q;
+    q.date_lo = cli_date(argc, argv, "--from", 0);
+    q.date_hi = cli_date(argc, argv, "--to", (int)pack_date(99, 99, AGG_MAX_YEAR));
+    if (q.date_lo < 0 || q.date_hi < 0) return 1;
+    const char *ts = cli_opt(argc, argv, "--type"), *cs = cli_opt(argc, argv, "--cat");
+    if ((q.type = cli_type(ts)) == -2) { fprintf(cli_err, "invalid type: %s\n", ts); return 1; }
+    int *sel = NULL;
+    if (cs) {
+        if (!(sel = calloc(MAX_CATS, sizeof(int)))) return 3;
+        for (const char *p = cs, *e = cs + strlen(cs); p < e; ) {
+            const char *fe = span_to(p, e, ',');
+            int c = cat_find(p, fe - p);
+            if (c < 0) fprintf(cli_err, "unknown category: %.*s\n", (int)(fe - p), p); else sel[c] = 1;
+            p = fe + 1;
+        }
+    }
+    q.cat_sel = sel;
+    if (cli_flag(argc, argv, "--list")) {
+        int first, end = date_index_range(q.date_lo, q.date_hi, &first);
+        for (int k = first; k < end; ++k) {
+            Transaction t; txn_load(lg->date_index[k], &t);
+            if ((q.type >= 0 && t.type != q.type) || (sel && !sel[t.cat])) continue;
+            write_txn_row(cli_out, &t);
+        }
+    }
+    RangeStats st; query_range(&q, &st);
+    free(sel);
+    fprintf(cli_out, "count,%ld\ntotal,%s\n", st.count, money_str(st.sum));
+    if (st.count) fprintf(cli_out, "average,%s\nmin,%s\nmax,%s\n", money_str(paise_avg(st.sum, st.count)), money_str(st.min), money_str(st.max));
+    return 0;
+}
+
+// ---- Benchmark ----------------------------------------------------------------
+// Synthetic ledgers of increasing size, timed through the same engine calls the
+// menus use. One JSON object per (size, operation) so runs can be diffed.
+
+static long peak_rss_kb(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    return GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)) ? (long)(pmc.PeakWorkingSetSize / 1024) : 0;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024;   // bytes there, kilobytes everywhere else
+#else
+    return ru.ru_maxrss;
+#endif
+#endif
+}
+
+static uint64_t bench_rand(uint64_t *s) {
+    *s ^= *s << 13; *s ^= *s >> 7; *s ^= *s << 17;
+    return *s;
+}
+
+// bytes < 0: not a throughput measurement, reported as null.
+static void bench_emit(const char *op, long rows, long ops, int64_t ns, int64_t bytes) {
+    fprintf(cli_out, "{\"op\":\"%s\",\"rows\":%ld,\"ops\":%ld,\"ns_per_op\":%.1f,\"mb_per_s\":", op, rows, ops, ops ? (double)ns / ops : 0.0);
+    if (bytes >= 0 && ns > 0) fprintf(cli_out, "%.1f", bytes / 1048576.0 / (ns / 1e9)); else fputs("null", cli_out);
+    fprintf(cli_out, ",\"peak_rss_kb\":%ld}\n", peak_rss_kb());
+    fflush(cli_out);
+}
+
+// One salary per month over 25 years, the rest random expenses; every row is
+// accepted by txn_check so the ledger looks like one built through the menus.
+static void bench_fill(long rows, uint64_t *seed) {
+    int exp_cats[DEFAULT_CAT_COUNT], n_exp = 0;
+    for (int c = 0; c < lg->cat_count && n_exp < DEFAULT_CAT_COUNT; ++c) if (lg->cats[c].kind == TXN_EXPENSE) exp_cats[n_exp++] = c;
+    Transaction t; memset(&t, 0, sizeof(t));
+    for (long i = 0; i < rows; ++i) {
+        t.id = next_txn_id();
+        if (i < 300) {
+            t.type = TXN_INCOME; t.cat = CAT_SALARY; t.amount = 10000000000LL;
+            t.day = 1; t.month = (int)(i % 12) + 1; t.year = 2000 + (int)(i / 12);
+        } else {
+            uint64_t r = bench_rand(seed);
+            t.type = TXN_EXPENSE; t.cat = exp_cats[r % n_exp]; t.amount = 1 + (int64_t)(r >> 8) % 500000;
+            t.day = 1 + (int)((r >> 32) % 28); t.month = 1 + (int)(r >> 40) % 12; t.year = 2000 + (int)(r >> 48) % 25;
+        }
+        if (i & 1) snprintf(t.note, sizeof(t.note), "bench row %ld", i); else t.note[0] = '\0';
+        ledger_insert(&t);
+    }
+}
+
+// Bytes on disk across the manifest and every partition it names.
+static int64_t bench_ledger_bytes(const char *user) {
+    char path[MAX_LINE]; ledger_manifest_path(user, path, sizeof(path));
+    int64_t bytes = file_size_of(path);
+    for (int i = 0; i < lg->part_count; ++i) { ledger_part_path(user, lg->parts[i].year, path, sizeof(path)); bytes += file_size_of(path); }
+    return bytes;
+}
+
+static void bench_size(const char *user, long rows) {
+    uint64_t seed = 0x9E3779B97F4A7C15ULL ^ (uint64_t)rows;
+    char bin[MAX_LINE], report[MAX_LINE];
+    ledger_manifest_path(user, bin, sizeof(bin));
+    snprintf(report, sizeof(report), "%s_report.csv", user);
+    volatile int64_t sink = 0;
+    int64_t t0;
+    long ops;
+
+    ledger_reset();
+    load_default_categories();
+    t0 = now_ns(); bench_fill(rows, &seed);
+    bench_emit("insert", rows, rows, now_ns() - t0, -1);
+
+    t0 = now_ns(); save_transactions_for_user(user);
+    bench_emit("save_transactions", rows, 1, now_ns() - t0, bench_ledger_bytes(user));
+
+    // login reads the manifest and the rollup written by the save, not a single row
+    t0 = now_ns(); load_transactions_for_user(user);
+    bench_emit("load_transactions", rows, 1, now_ns() - t0, file_size_of(bin));
+
+    t0 = now_ns(); ledger_need_years(AGG_MIN_YEAR, AGG_MAX_YEAR);
+    bench_emit("load_all_partitions", rows, lg->part_count, now_ns() - t0, bench_ledger_bytes(user));
+
+    t0 = now_ns(); date_index_ensure();
+    bench_emit("date_index_build", rows, 1, now_ns() - t0, -1);
+
+    ops = 1000000;
+    t0 = now_ns();
+    for (long i = 0; i < ops; ++i) {
+        uint64_t r = bench_rand(&seed);
+        int m = 1 + (int)(r % 12), y = 2000 + (int)(r >> 8) % 25;
+        sink += (i & 1) ? sum_expense_month(m, y) : sum_income_month(m, y);
+    }
+    bench_emit("month_totals", rows, ops, now_ns() - t0, -1);
+
+    t0 = now_ns();
+    for (long i = 0; i < ops; ++i) sink += find_txn_by_id(1 + (int)(bench_rand(&seed) % rows));
+    bench_emit("find_txn_by_id", rows, ops, now_ns() - t0, -1);
+
+    ops = 100000;
+    t0 = now_ns();
+    for (long i = 0; i < ops; ++i) {
+        uint64_t r = bench_rand(&seed);
+        int d = (int)pack_date(1 + (int)(r % 28), 1 + (int)(r >> 8) % 12, 2000 + (int)(r >> 16) % 25);
+        int first, end = date_index_range(d, d, &first);
+        for (int k = first; k < end; ++k) { Transaction t; txn_load(lg->date_index[k], &t); sink += t.amount; }
+    }
+    bench_emit("date_search", rows, ops, now_ns() - t0, -1);
+
+    ops = 1000;
+    RangeQuery q; q.type = TXN_EXPENSE; q.cat_sel = NULL;
+    t0 = now_ns();
+    for (long i = 0; i < ops; ++i) {
+        uint64_t r = bench_rand(&seed);
+        int y = 2000 + (int)(r % 25), m = 1 + (int)(r >> 8) % 12;
+        q.date_lo = (int)pack_date(1, m, y); q.date_hi = (int)pack_date(31, m, y);
+        RangeStats st; query_range(&q, &st); sink += st.sum;
+    }
+    bench_emit("range_query", rows, ops, now_ns() - t0, (int64_t)ops * lg->txn_slots * (4 + 4 + 1 + 2 + 8));
+
+    ops = 100000;
+    t0 = now_ns();
+    for (long i = 0; i < ops; ++i) {
+        uint64_t r = bench_rand(&seed);
+        sink += balance_as_of((int)pack_date(1 + (int)(r % 28), 1 + (int)(r >> 8) % 12, 2000 + (int)(r >> 16) % 25));
+    }
+    bench_emit("balance_as_of", rows, ops, now_ns() - t0, -1);
+
+    ReportTotals tot;
+    t0 = now_ns(); write_report(report, REPORT_CSV, 0, (int)pack_date(99, 99, AGG_MAX_YEAR), "bench", &tot);
+    bench_emit("export_report", rows, 1, now_ns() - t0, file_size_of(report));
+
+    ops = rows / 10 < 100000 ? (rows / 10 ? rows / 10 : 1) : 100000;
+    t0 = now_ns();
+    for (long i = 0; i < ops; ++i) sink += delete_txn_by_id(1 + (int)(i * (rows / ops)));
+    bench_emit("delete_txn_by_id", rows, ops, now_ns() - t0, -1);
+
+    for (int i = 0; i < lg->part_count; ++i) { ledger_part_path(user, lg->parts[i].year, report, sizeof(report)); remove(report); }
+    rollup_path(user, report, sizeof(report)); remove(report);
+    snprintf(report, sizeof(report), "%s_report.csv", user);
+    remove(bin); remove(report);
+    (void)sink;
+}
+
+// Runs against a private ledger under a throwaway user name in the current
+// directory; nothing of the signed-in user's is touched.
+static int cli_bench(int argc, char **argv) {
+    const char *one = cli_opt(argc, argv, "--rows"), *max = cli_opt(argc, argv, "--max-rows"), *out = cli_opt(argc, argv, "--out");
+    long lo = one ? atol(one) : 1000, hi = one ? lo : (max ? atol(max) : 1000000);
+    if (lo < 1 || hi < lo || hi > 100000000) { fprintf(cli_err, "row counts must be between 1 and 100000000\n"); return 1; }
+    if (out && !(cli_out = fopen(out, "w"))) { cli_out = stdout; fprintf(cli_err, "cannot open %s\n", out); return 3; }
+    Ledger bench, *saved = lg;
+    memset(&bench, 0, sizeof(bench)); bench.lock_fd = -1;
+    lg = &bench;
+    char user[64], lock[MAX_LINE];
+    snprintf(user, sizeof(user), "_bench_%d", (int)getpid());
+    fprintf(cli_err, "kernel: range queries use %s\n", (select_range_kernel(), range_kernel_name));
+    for (long rows = lo; rows <= hi; rows *= 10) {
+        strcpy(lg->user, user);
+        bench_size(user, rows);
+        ledger_free();
+        if (rows > hi / 10) break;
+    }
+    lock_path(user, lock, sizeof(lock)); remove(lock);
+    lg = saved;
+    if (out) { fclose(cli_out); cli_out = stdout; }
+    return 0;
+}
+
+// Most useful against a daemon, whose counters cover every request it served.
+static int cli_stats(int argc, char **argv) {
+    stats_lines(stats_line_to_file, cli_out, cli_flag(argc, argv, "--histograms"));
+    return 0;
+}
+
+typedef struct {
+    const char *name;
+    int (*run)(int, char **);
+    int writes;         // needs the ledger exclusively
+    int file;           // its argument names a file to read or write
+} CliCommand;
+
+static const CliCommand cli_commands[] = {
+    {"import", cli_import, 1, 1}, {"add", cli_add, 1, 0}, {"summary", cli_summary, 0, 0}, {"export", cli_export, 0, 1},
+    {"query", cli_query, 0, 0}, {"stats", cli_stats, 0, 0},
+};
+
+static const CliCommand *cli_find(const char *name) {
+    for (size_t i = 0; i < sizeof(cli_commands) / sizeof(cli_commands[0]); ++i)
+        if (strcmp(name, cli_commands[i].name) == 0) return &cli_commands[i];
+    return NULL;
+}
+
+#ifndef _WIN32
+// ---- Daemon mode ------------------------------------------------------------
+// One request per connection: a single line holding the command's arguments
+// (double-quoted, backslash-escaped), answered with the command's output and
+// a final "%exit N" line. Ledgers stay resident after first use; each has a
+// reader/writer lock so summaries, queries and exports run side by side while
+// imports and adds get the ledger to themselves.
+
+typedef struct Resident {
+    Ledger ledger;
+    pthread_rwlock_t lock;
+    struct Resident *next;
+} Resident;
+
+static Resident *residents = NULL;
+static pthread_mutex_t residents_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t users_mu = PTHREAD_MUTEX_INITIALIZER;  // the user directory is process-wide
+static int serve_queue[SERVE_QUEUE];
+static int serve_head = 0, serve_len = 0, serve_stopping = 0;
+static pthread_mutex_t serve_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t serve_nonempty = PTHREAD_COND_INITIALIZER, serve_nonfull = PTHREAD_COND_INITIALIZER;
+static volatile sig_atomic_t serve_signalled = 0;
+
+static void serve_on_signal(int sig) { (void)sig; serve_signalled = 1; }
+
+// Readers share a resident, so they must find everything they touch already
+// in memory: partitions are faulted in, and the date index and balance trees
+// built, under the write lock after every load, catch-up and write.
+static void resident_warm(void) {
+    ledger_need_years(AGG_MIN_YEAR, AGG_MAX_YEAR);
+    date_index_ensure();
+    flow_trees_ensure();
+}
+
+// Returns the user's resident ledger, loading it on first use. The loader
+// holds the write lock while it fills the ledger, so concurrent first requests
+// simply wait on the lock.
+static Resident *resident_get(const char *user) {
+    pthread_mutex_lock(&residents_lock);
+    Resident *r = residents;
+    while (r && strcmp(r->ledger.user, user)) r = r->next;
+    if (r) { pthread_mutex_unlock(&residents_lock); return r; }
+    if (!(r = calloc(1, sizeof(*r)))) { pthread_mutex_unlock(&residents_lock); return NULL; }
+    r->ledger.next_id = 1; r->ledger.lock_fd = -1;
+    strncpy(r->ledger.user, user, sizeof(r->ledger.user)-1);
+    pthread_rwlock_init(&r->lock, NULL);
+    pthread_rwlock_wrlock(&r->lock);
+    r->next = residents; residents = r;
+    pthread_mutex_unlock(&residents_lock);
+
+    lg = &r->ledger;
+    ledger_load_user();
+    resident_warm();  // the load itself stops at the rollup; the rows come in here
+    if (load_bad_lines) { fprintf(stderr, "%s: skipped %d malformed line(s); first: %s\n", user, load_bad_lines, load_warning); load_bad_lines = 0; }
+    lg = &main_ledger;
+    pthread_rwlock_unlock(&r->lock);
+    return r;
+}
+
+// Clients may only name files below the daemon's working directory.
+static int serve_path_ok(const char *path) {
+    if (!path || path[0] == '/') return 0;
+    for (const char *c = path; *c; ) {
+        size_t n = strcspn(c, "/");
+        if (n == 2 && c[0] == '.' && c[1] == '.') return 0;
+        c += n; if (*c) c++;
+    }
+    return 1;
+}
+
+static int serve_run(const CliCommand *cmd, int argc, char **argv) {
+    const char *u = cli_opt(argc, argv, "-u"), *p = cli_opt(argc, argv, "-p");
+    if (!u || !p) { cli_usage(); return 1; }
+    if (cmd->file && cli_arg(argc, argv) && !serve_path_ok(cli_arg(argc, argv))) {
+        fprintf(cli_err, "%s: only relative paths inside the daemon's directory are allowed\n", cli_arg(argc, argv));
+        return 1;
+    }
+    pthread_mutex_lock(&users_mu);
+    int ok = verify_user_file(u, p);
+    pthread_mutex_unlock(&users_mu);
+    if (!ok) { fprintf(cli_err, "login failed for %s\n", u); return 2; }
+    Resident *r = resident_get(u);
+    if (!r) { fprintf(cli_err, "out of memory\n"); return 3; }
+    lg = &r->ledger;
+    if (cmd->writes) pthread_rwlock_wrlock(&r->lock);
+    else {
+        // The check reads what a loader or writer fills in, so it waits for them too.
+        pthread_rwlock_rdlock(&r->lock);
+        if (ledger_stale()) {  // another process wrote: catch up once, exclusively
+            pthread_rwlock_unlock(&r->lock);
+            pthread_rwlock_wrlock(&r->lock);
+            ledger_lock(0); ledger_sync(); ledger_unlock();
+            resident_warm();
+            pthread_rwlock_unlock(&r->lock);
+            pthread_rwlock_rdlock(&r->lock);
+        }
+    }
+    int rc = cmd->run(argc, argv);
+    if (cmd->writes) resident_warm();  // readers must never fault in or rebuild anything
+    lg = &main_ledger;
+    pthread_rwlock_unlock(&r->lock);
+    return rc;
+}
+
+// Splits a request line into argv in place; argv[0] is a placeholder program name.
+static int serve_split(char *line, char **argv) {
+    int argc = 0;
+    argv[argc++] = "budget";
+    char *w = line;
+    for (char *p = line; *p && argc < SERVE_MAX_ARGS; ) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p) break;
+        argv[argc++] = w;
+        if (*p == '"') {
+            for (p++; *p && *p != '"'; p++) { if (*p == '\\' && p[1]) p++; *w++ = *p; }
+            if (*p) p++;
+        } else while (*p && *p != ' ' && *p != '\t') *w++ = *p++;
+        *w++ = '\0';
+    }
+    return argc;
+}
+
+static void serve_client(int fd) {
+    char line[MAX_LINE * 4];
+    size_t n = 0;
+    ssize_t got;
+    while (n < sizeof(line) - 1 && (got = read(fd, line + n, sizeof(line) - 1 - n)) > 0) {
+        n += got;
+        if (memchr(line + n - got, '\n', got)) break;
+    }
+    line[n] = '\0';
+    char *nl = strchr(line, '\n');
+    if (nl) *nl = '\0';
+    FILE *out = fdopen(fd, "w");
+    if (!out) { close(fd); return; }
+    cli_out = cli_err = out;
+    char *argv[SERVE_MAX_ARGS];
+    int argc = serve_split(line, argv), rc;
+    const CliCommand *cmd = argc > 1 ? cli_find(argv[1]) : NULL;
+    if (!nl) { fprintf(out, "request too long or incomplete\n"); rc = 1; }
+    else if (!cmd) { cli_usage(); rc = 1; }
+    else rc = serve_run(cmd, argc, argv);
+    fprintf(out, "%%exit %d\n", rc);
+    fclose(out);
+}
+
+static void *serve_worker(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&serve_mu);
+        while (!serve_len && !serve_stopping) pthread_cond_wait(&serve_nonempty, &serve_mu);
+        if (!serve_len) { pthread_mutex_unlock(&serve_mu); return NULL; }
+        int fd = serve_queue[serve_head];
+        serve_head = (serve_head + 1) % SERVE_QUEUE; serve_len--;
+        pthread_cond_signal(&serve_nonfull);
+        pthread_mutex_unlock(&serve_mu);
+        serve_client(fd);
+    }
+}
+
+static int cli_serve(int argc, char **argv) {
+    const char *path = cli_opt(argc, argv, "--socket"), *ts = cli_opt(argc, argv, "--threads");
+    int threads = ts ? atoi(ts) : SERVE_THREADS;
+    struct sockaddr_un addr;
+    if (!path || threads < 1 || strlen(path) >= sizeof(addr.sun_path)) { cli_usage(); return 1; }
+    int ls = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ls < 0) { perror("socket"); return 3; }
+    memset(&addr, 0, sizeof(addr)); addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(ls, (struct sockaddr *)&addr, sizeof(addr)) < 0 || chmod(path, 0600) < 0 || listen(ls, SERVE_QUEUE) < 0) {
+        perror(path); close(ls); return 3;
+    }
+
+    struct sigaction sa; memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serve_on_signal;  // no SA_RESTART: accept() must return so we can shut down
+    sigaction(SIGINT, &sa, NULL); sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    select_range_kernel();  // before any worker can race to pick it
+
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    if (!tids) { close(ls); return 3; }
+    for (int i = 0; i < threads; ++i) pthread_create(&tids[i], NULL, serve_worker, NULL);
+    fprintf(stderr, "serving on %s with %d worker(s)\n", path, threads);
+
+    while (!serve_signalled) {
+        int fd = accept(ls, NULL, NULL);
+        if (fd < 0) { if (errno == EINTR || errno == ECONNABORTED) continue; perror("accept"); break; }
+        struct timeval tv = {10, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));  // an idle client must not pin a worker
+        pthread_mutex_lock(&serve_mu);
+        while (serve_len == SERVE_QUEUE) pthread_cond_wait(&serve_nonfull, &serve_mu);
+        serve_queue[(serve_head + serve_len++) % SERVE_QUEUE] = fd;
+        pthread_cond_signal(&serve_nonempty);
+        pthread_mutex_unlock(&serve_mu);
+    }
+
+    close(ls); unlink(path);
+    pthread_mutex_lock(&serve_mu);
+    serve_stopping = 1;
+    pthread_cond_broadcast(&serve_nonempty);
+    pthread_mutex_unlock(&serve_mu);
+    for (int i = 0; i < threads; ++i) pthread_join(tids[i], NULL);
+    free(tids);
+    for (Resident *r = residents; r; r = r->next) {
+        lg = &r->ledger;
+        compact_transactions_for_user(lg->user);
+        save_settings_for_user(lg->user);
+    }
+    lg = &main_ledger;
+    fprintf(stderr, "stopped\n");
+    return 0;
+}
+
+// Forwards this command line to a daemon and relays its answer.
+static int cli_remote(const char *path, int argc, char **argv) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) { cli_usage(); return 1; }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr)); addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) { perror(path); if (fd >= 0) close(fd); return 3; }
+    FILE *f = fdopen(fd, "r+");
+    if (!f) { close(fd); return 3; }
+    const char *pass = cli_opt(argc, argv, "-p");
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--socket") == 0) { ++i; continue; }
+        fputc('"', f);
+        for (const char *c = argv[i]; *c; ++c) { if (*c == '"' || *c == '\\') fputc('\\', f); fputc(*c, f); }
+        fputs("\" ", f);
+    }
+    if (!pass && getenv("PF_PASSWORD")) {
+        fputs("\"-p\" \"", f);
+        for (const char *c = getenv("PF_PASSWORD"); *c; ++c) { if (*c == '"' || *c == '\\') fputc('\\', f); fputc(*c, f); }
+        fputc('"', f);
+    }
+    fputc('\n', f); fflush(f);
+    char line[MAX_LINE];
+    int rc = 3;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "%exit ", 6) == 0) { rc = atoi(line + 6); break; }
+        fputs(line, stdout);
+    }
+    fclose(f);
+    return rc;
+}
+#endif
+
+static int cli_main(int argc, char **argv) {
+    cli_out = stdout; cli_err = stderr;
+    if (strcmp(argv[1], "serve") == 0) {
+#ifndef _WIN32
+        return cli_serve(argc, argv);
+#else
+        fprintf(stderr, "serve is not available on Windows\n");
+        return 1;
+#endif
+    }
+    if (strcmp(argv[1], "bench") == 0) return cli_bench(argc, argv);
+    const CliCommand *cmd = cli_find(argv[1]);
+    if (!cmd) { cli_usage(); return 1; }
+#ifndef _WIN32
+    const char *sock = cli_opt(argc, argv, "--socket");
+    if (sock) return cli_remote(sock, argc, argv);
+#endif
+    if (!cli_login(argc, argv)) return 2;
+    int rc = cmd->run(argc, argv);
+    if (lg->journal_fp) { fclose(lg->journal_fp); lg->journal_fp = NULL; }
+    return rc;
+}
+
+// The menus are defined after main; C99 and later have no implicit declarations.
+void manage_transactions_menu(void);
+void manage_categories_menu(void);
+void view_summary_menu(void);
+void set_budget_menu(void);
+void generate_export_report(void);
+void settings_menu(void);
+
+int main(int argc, char **argv) {
+    if (argc > 1) return cli_main(argc, argv);
+    interactive_session = 1;
+#ifdef _WIN32
+    // the screen is drawn with ANSI sequences, clearing included
+    DWORD mode; HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (GetConsoleMode(out, &mode)) SetConsoleMode(out, mode | 0x0004 /* ENABLE_VIRTUAL_TERMINAL_PROCESSING */);
+#endif
+    atexit(scr_flush);
     load_default_categories();
     auth_menu();
-    while (cur_user[0]) {
+    while (lg->user[0]) {
+        ledger_refresh();
         print_header("MAIN MENU");
-        char greet[80]; snprintf(greet,sizeof(greet),"Hello, %s", cur_user); 
+        char greet[80]; snprintf(greet,sizeof(greet),"Hello, %s", lg->user); 
         print_centered_in_container(greet, C_CYAN);
         print_empty_line_in_container();
         print_left_in_container("1) Dashboard (Summary & Recent)", C_RESET);
@@ -582,7 +4161,7 @@ int main(void) {
         print_left_in_container("4) Manage Categories (View/Add)", C_RESET);
         print_left_in_container("5) View Detailed Summary (Monthly/Yearly)", C_RESET);
         print_left_in_container("6) Set Monthly Budget", C_RESET);
-        print_left_in_container("7) Export Report (TXT)", C_RESET);
+        print_left_in_container("7) Export Report (TXT/CSV/JSON)", C_RESET);
         print_left_in_container("8) Settings (Password/About)", C_RESET);
         print_left_in_container("9) Save & Logout", C_RESET);
         print_left_in_container("0) Exit", C_RESET);
@@ -591,8 +4170,8 @@ int main(void) {
         char buf[32]; get_input("Enter choice", buf, sizeof(buf));
         
         if (buf[0]=='0') { 
-            save_transactions_for_user(cur_user); 
-            save_settings_for_user(cur_user); 
+            compact_transactions_for_user(lg->user); 
+            save_settings_for_user(lg->user); 
             print_header("Goodbye."); 
             break; 
         } else if (strcmp(buf,"1")==0) { dashboard_menu(); }
@@ -604,9 +4183,10 @@ int main(void) {
         else if (strcmp(buf,"7")==0) generate_export_report();
         else if (strcmp(buf,"8")==0) settings_menu();
         else if (strcmp(buf,"9")==0) { 
-            save_transactions_for_user(cur_user); 
-            save_settings_for_user(cur_user); 
-            cur_user[0]=0; 
+            compact_transactions_for_user(lg->user); 
+            save_settings_for_user(lg->user); 
+            ledger_release();
+            lg->user[0]=0; 
             auth_menu(); 
         } else { print_error("Invalid choice."); wait_enter_center(); }
         print_footer();
@@ -615,27 +4195,40 @@ int main(void) {
 }
 void manage_transactions_menu(void) {
     while (1) {
+        ledger_refresh();
         print_header("MANAGE TRANSACTIONS");
         print_left_in_container("1) Add Transaction (Quick)", C_RESET);
         print_left_in_container("2) Edit Transaction by ID", C_RESET);
         print_left_in_container("3) Delete Transaction by ID", C_RESET);
         print_left_in_container("4) Search Transactions by Date (DD/MM/YYYY)", C_RESET);
+        print_left_in_container("5) Search Transactions by Date Range", C_RESET);
+        print_left_in_container("6) Export All Transactions (CSV)", C_RESET);
+        print_left_in_container("7) Import Transactions from CSV", C_RESET);
+        print_left_in_container("8) Search Notes & Categories", C_RESET);
         print_left_in_container("0) Back", C_RESET);
         char buf[32]; get_input("Choice", buf, sizeof(buf));
         if (buf[0] == '0') { print_footer(); return; }
         if (buf[0] == '1') { add_transaction_flow_with_month(0,0); }
         else if (buf[0] == '2') {
             get_input("Enter transaction ID to edit", buf, sizeof(buf)); int id = atoi(buf);
-            Transaction *t = find_txn_by_id(id);
-            if (!t) { print_error("Not found."); wait_enter_center(); continue; }
+            int slot = find_txn_by_id(id);
+            if (slot < 0) { print_error("Not found."); wait_enter_center(); continue; }
+            Transaction edited, *t = &edited; txn_load(slot, t);
             print_header("EDIT TRANSACTION");
-            char tmp[128];
-            snprintf(tmp,sizeof(tmp),"Current Type: %s", t->type); print_centered_in_container(tmp, C_RESET);
-            get_input("Enter new type (Income/Expense) or blank", tmp, sizeof(tmp)); if (tmp[0]) { strncpy(t->type,tmp,sizeof(t->type)-1); t->type[sizeof(t->type)-1]='\0'; }
-            snprintf(tmp,sizeof(tmp),"Current Category: %s", t->category); print_centered_in_container(tmp, C_RESET);
-            get_input("Enter new category or blank", tmp, sizeof(tmp)); if (tmp[0]) { strncpy(t->category,tmp,sizeof(t->category)-1); t->category[sizeof(t->category)-1]='\0'; }
-            snprintf(tmp,sizeof(tmp),"Current amount: %.2f", t->amount); print_centered_in_container(tmp, C_RESET);
-            get_input("Enter new amount or blank", tmp, sizeof(tmp)); if (tmp[0]) t->amount = atof(tmp);
+            char tmp[sizeof(t->note) + 16];  // "Current note: " plus a full note
+            snprintf(tmp,sizeof(tmp),"Current Type: %s", txn_type_name(t->type)); print_centered_in_container(tmp, C_RESET);
+            get_input("Enter new type (Income/Expense) or blank", tmp, sizeof(tmp));
+            if (tmp[0]) {
+                if (strcasecmp(tmp, "Income") == 0) t->type = TXN_INCOME;
+                else if (strcasecmp(tmp, "Expense") == 0) t->type = TXN_EXPENSE;
+                else print_error("Invalid type ignored.");
+            }
+            snprintf(tmp,sizeof(tmp),"Current Category: %s", cat_name(t->cat)); print_centered_in_container(tmp, C_RESET);
+            get_input("Enter new category or blank", tmp, sizeof(tmp));
+            if (tmp[0]) { int c = add_category(tmp, t->type); if (c >= 0) t->cat = c; else print_error("Too many categories."); }
+            snprintf(tmp,sizeof(tmp),"Current amount: %s", money_str(t->amount)); print_centered_in_container(tmp, C_RESET);
+            get_input("Enter new amount or blank", tmp, sizeof(tmp));
+            if (tmp[0] && (!parse_money(tmp, &t->amount) || t->amount <= 0)) { print_error("Invalid amount."); wait_enter_center(); continue; }
             char datebuf[16]; snprintf(datebuf,sizeof(datebuf), "%02d/%02d/%04d", t->day, t->month, t->year);
             snprintf(tmp,sizeof(tmp),"Current date: %s", datebuf); print_centered_in_container(tmp, C_RESET);
             get_input("Enter new date DD/MM/YYYY or blank", tmp, sizeof(tmp));
@@ -645,32 +4238,76 @@ void manage_transactions_menu(void) {
                     if (sscanf(tmp,"%d/%d/%d",&dd,&mm,&yy) == 3) { t->day=dd; t->month=mm; t->year=yy; }
                 } else print_error("Invalid date ignored."); 
             }
-            snprintf(tmp,sizeof(tmp),"Current note: %s", t->note[0]?t->note:"NA"); print_centered_in_container(tmp, C_RESET);
-            get_input("Enter new note or blank", tmp, sizeof(tmp)); if (tmp[0]) { strncpy(t->note,tmp,sizeof(t->note)-1); t->note[sizeof(t->note)-1]='\0'; }
-            save_transactions_for_user(cur_user);
+            snprintf(tmp,sizeof(tmp),"Current note: %.*s", (int)sizeof(t->note) - 1, t->note[0]?t->note:"NA"); print_centered_in_container(tmp, C_RESET);
+            get_input("Enter new note or blank", tmp, sizeof(t->note)); if (tmp[0]) strcpy(t->note, tmp);
+            if (!ledger_begin_write_for(t)) { ledger_unlock(); print_error("Too many categories."); wait_enter_center(); continue; }
+            if ((slot = find_txn_by_id(id)) < 0) { ledger_unlock(); print_error("Deleted by another session."); wait_enter_center(); continue; }
+            ledger_update(slot, t);
+            journal_append('E', t);
+            ledger_unlock();
             print_success("Updated."); wait_enter_center();
         } else if (buf[0] == '3') {
             get_input("Enter transaction ID to delete", buf, sizeof(buf)); int id = atoi(buf);
-            if (delete_txn_by_id(id)) { save_transactions_for_user(cur_user); print_success("Deleted."); }
-            else print_error("Not found.");
+            ledger_begin_write();
+            int gone_ok = delete_txn_by_id(id);
+            if (gone_ok) { Transaction gone; gone.id = id; journal_append('D', &gone); }
+            ledger_unlock();
+            if (gone_ok) print_success("Deleted."); else print_error("Not found.");
             wait_enter_center();
         } else if (buf[0] == '4') {
             get_input("Enter date DD/MM/YYYY to search", buf, sizeof(buf));
             if (!is_valid_date(buf)) { print_error("Invalid date format."); wait_enter_center(); continue; }
             char h_buf[128]; snprintf(h_buf, sizeof(h_buf), "Search results for %s", buf);
-            print_header(h_buf);
-            int found = 0;
             int dd,mm,yy; sscanf(buf,"%d/%d/%d",&dd,&mm,&yy);
-            for (int i=0;i<txn_count;i++) {
-                if (txns[i].day==dd && txns[i].month==mm && txns[i].year==yy) {
-                    char line[256]; char* color = (strcmp(txns[i].type, "Income") == 0) ? C_GREEN : C_RED;
-                    snprintf(line,sizeof(line),"ID:%d | %02d/%02d/%04d | %-8s | %-15s | %.2f | %s",
-                                               txns[i].id, txns[i].day, txns[i].month, txns[i].year, txns[i].type, txns[i].category, txns[i].amount, txns[i].note[0]?txns[i].note:"NA");
-                    print_left_in_container(line, color); found++;
+            int key = (int)pack_date(dd, mm, yy);
+            show_txns_in_range(h_buf, key, key);
+            continue;
+        } else if (buf[0] == '5') {
+            char from[32], to[32];
+            get_input("From date DD/MM/YYYY", from, sizeof(from));
+            get_input("To date DD/MM/YYYY", to, sizeof(to));
+            if (!is_valid_date(from) || !is_valid_date(to)) { print_error("Invalid date format."); wait_enter_center(); continue; }
+            int d1,m1,y1,d2,m2,y2; sscanf(from,"%d/%d/%d",&d1,&m1,&y1); sscanf(to,"%d/%d/%d",&d2,&m2,&y2);
+            int lo = (int)pack_date(d1, m1, y1), hi = (int)pack_date(d2, m2, y2);
+            if (lo > hi) { print_error("From date is after To date."); wait_enter_center(); continue; }
+            char h_buf[128]; snprintf(h_buf, sizeof(h_buf), "Search results %s - %s", from, to);
+            show_txns_in_range(h_buf, lo, hi);
+            continue;
+        } else if (buf[0] == '6') {
+            char fname[128]; snprintf(fname, sizeof(fname), "export_%s_txns.csv", lg->user);
+            int n = export_transactions_csv(fname);
+            if (n < 0) print_error("Failed to create export file.");
+            else { char msg[192]; snprintf(msg, sizeof(msg), "Exported %d transactions to %s", n, fname); print_success(msg); }
+            wait_enter_center();
+        } else if (buf[0] == '7') {
+            char fname[MAX_LINE]; get_input("Enter CSV file path", fname, sizeof(fname));
+            get_input("Allow expenses above the month's income? (Y/N)", buf, sizeof(buf));
+            TxnBatch b;
+            int n = import_transactions_csv(fname, (buf[0]=='Y' || buf[0]=='y') ? IMPORT_ALLOW_OVER_INCOME : 0, &b);
+            if (n < 0) print_error("Could not open file.");
+            else {
+                char msg[256]; snprintf(msg, sizeof(msg), "Imported %d transactions.", n); print_success(msg);
+                if (b.count > n) {
+                    int first = 0; while (!b.why[first]) first++;
+                    snprintf(msg, sizeof(msg), "Rejected %d row(s). First at line %ld:", b.count - n, b.line_no[first]);
+                    print_error(msg);
+                    print_centered_in_container(b.why[first], C_YELLOW);
                 }
+                if (b.over_budget) { snprintf(msg, sizeof(msg), "%d expense(s) cross the monthly budget.", b.over_budget); print_centered_in_container(msg, C_B_RED); }
+                show_load_warnings();
             }
-            if (!found) print_centered_in_container("No transactions found for that date.", C_RESET);
+            batch_free(&b);
             wait_enter_center();
+        } else if (buf[0] == '8') {
+            char text[128]; get_input("Words to find (all must match, any case)", text, sizeof(text));
+            int64_t t0 = now_ns();
+            int *rows, n = text_search(text, &rows);
+            double ms = (double)(now_ns() - t0) / 1e6;
+            if (rows) qsort(rows, n, sizeof(int), txn_newest_cmp);
+            char h_buf[192]; snprintf(h_buf, sizeof(h_buf), "\"%.60s\": %d match%s in %.1f ms", text, n, n == 1 ? "" : "es", ms);
+            list_view(h_buf, n, recent_row, rows);
+            free(rows);
+            continue;
         } else { print_error("Invalid choice."); wait_enter_center(); }
         print_footer();
     }
@@ -680,72 +4317,183 @@ void manage_categories_menu(void) {
     while (1) {
         print_header("MANAGE CATEGORIES");
         print_left_in_container("1) View categories", C_RESET);
-        print_left_in_container("2) Add category (session)", C_RESET);
+        print_left_in_container("2) Add category", C_RESET);
         print_left_in_container("0) Back", C_RESET);
         char c[64]; get_input("Choice", c, sizeof(c));
         if (c[0] == '0') { print_footer(); return; }
         if (c[0] == '1') {
             print_header("CATEGORIES");
-            for (int i=0;i<cat_count;i++) { char line[128]; snprintf(line,sizeof(line), "%d) %s", i+1, cats[i]); print_left_in_container(line, C_RESET); }
+            for (int i=0;i<lg->cat_count;i++) { char line[128]; snprintf(line,sizeof(line), "%d) %-40s %s", i+1, lg->cats[i].name, txn_type_name(lg->cats[i].kind)); print_left_in_container(line, C_RESET); }
             wait_enter_center();
         } else if (c[0] == '2') {
-            char name[64]; get_input("Enter new category name", name, sizeof(name));
-            add_category_session(name);
-            print_success("Added (session).");
+            char name[64], kind[16]; get_input("Enter new category name", name, sizeof(name));
+            get_input("Income or expense category? (I/E)", kind, sizeof(kind));
+            if (!name[0]) print_error("Category cannot be empty.");
+            else if (add_category(name, (kind[0]=='I' || kind[0]=='i') ? TXN_INCOME : TXN_EXPENSE) < 0) print_error("Too many categories.");
+            else print_success("Added.");
             wait_enter_center();
         } else { print_error("Invalid choice."); wait_enter_center(); }
         print_footer();
     }
 }
 
+typedef struct {
+    CatTotal *rows;
+    int n;
+    int64_t income, expense;    // paise, for the share column
+} CatBreakdown;
+
+// Share is of the period's spend for expense categories, of its income otherwise
+// (marked "in").
+static void cat_breakdown_row(void *ctx, int i, char *line, size_t sz, const char **color) {
+    const CatBreakdown *b = ctx;
+    const CatTotal *t = &b->rows[i];
+    int spend = t->expense >= t->income;
+    int64_t amt = spend ? t->expense : t->income, of = spend ? b->expense : b->income;
+    *color = spend ? C_RED : C_GREEN;
+    snprintf(line, sz, "%2d. %-18.18s %6ld txn  Rs. %12s %6.1f%%%s", i + 1, cat_name(t->cat), t->count,
+             money_str(amt), of ? 100.0 * (double)amt / (double)of : 0.0, spend ? "" : " in");
+}
+
 void view_summary_menu(void) {
     while (1) {
+        ledger_refresh();
         print_header("SUMMARY");
         print_left_in_container("1) Monthly summary", C_RESET);
         print_left_in_container("2) Yearly summary", C_RESET);
+        print_left_in_container("3) Date range query (by category)", C_RESET);
+        print_left_in_container("4) Spend by category for a month", C_RESET);
+        print_left_in_container("5) Top categories for a year", C_RESET);
+        print_left_in_container("6) Balance as of a date", C_RESET);
+        print_left_in_container("7) Net flow between dates", C_RESET);
         print_left_in_container("0) Back", C_RESET);
         char c[64]; get_input("Choice", c, sizeof(c));
         if (c[0] == '0') { print_footer(); return; }
         if (c[0] == '1') {
             get_input("Enter month (1-12)", c, sizeof(c)); int m = atoi(c);
             get_input("Enter year (e.g., 2025)", c, sizeof(c)); int y = atoi(c);
-            double inc = sum_income_month(m,y), ex = sum_expense_month(m,y);
-            double net = inc - ex;
+            int64_t inc = sum_income_month(m,y), ex = sum_expense_month(m,y);
+            int64_t net = inc - ex;
             char h_buf[128]; snprintf(h_buf, sizeof(h_buf), "Monthly Summary %02d/%04d", m, y);
             print_header(h_buf);
             char l1[80], l2[80], l3[80];
-            snprintf(l1,sizeof(l1),"Total Income : Rs. %.2f", inc); print_centered_in_container(l1, C_B_GREEN);
-            snprintf(l2,sizeof(l2),"Total Expense: Rs. %.2f", ex); print_centered_in_container(l2, C_B_RED);
-            snprintf(l3,sizeof(l3),"Net Savings  : Rs. %.2f", net); print_centered_in_container(l3, C_YELLOW);
+            snprintf(l1,sizeof(l1),"Total Income : Rs. %s", money_str(inc)); print_centered_in_container(l1, C_B_GREEN);
+            snprintf(l2,sizeof(l2),"Total Expense: Rs. %s", money_str(ex)); print_centered_in_container(l2, C_B_RED);
+            snprintf(l3,sizeof(l3),"Net Savings  : Rs. %s", money_str(net)); print_centered_in_container(l3, C_YELLOW);
 
             print_centered_in_container("--- Financial Health ---", C_RESET);
             if (ex > inc) { print_error("Health: Expenses exceed income!"); } 
             else {
-                double ratio = inc ? (ex/inc*100.0) : 0;
-                if (ratio > 80.0) { print_centered_in_container("Health: High spending (>80% of income)", C_YELLOW); } 
+                if (ex * 5 > inc * 4) { print_centered_in_container("Health: High spending (>80% of income)", C_YELLOW); } 
                 else { print_success("Health: Good"); }
             }
             wait_enter_center();
         } else if (c[0] == '2') {
             get_input("Enter year (e.g., 2025)", c, sizeof(c)); int y = atoi(c);
-            double yi=0, ye=0; int months_present=0;
+            int64_t yi=0, ye=0; int months_present=0;
             for (int m=1;m<=12;m++) {
-                double inc = sum_income_month(m,y), ex = sum_expense_month(m,y);
+                int64_t inc = sum_income_month(m,y), ex = sum_expense_month(m,y);
                 if (inc || ex) months_present++;
                 yi+=inc; ye+=ex;
             }
             char h_buf[128]; snprintf(h_buf, sizeof(h_buf), "Yearly Summary %04d", y);
             print_header(h_buf);
             char l1[80], l2[80], l3[80];
-            snprintf(l1,sizeof(l1),"Year Income : Rs. %.2f", yi); print_centered_in_container(l1, C_B_GREEN);
-            snprintf(l2,sizeof(l2),"Year Expense: Rs. %.2f", ye); print_centered_in_container(l2, C_B_RED);
-            snprintf(l3,sizeof(l3),"Year Savings: Rs. %.2f", yi-ye); print_centered_in_container(l3, C_YELLOW);
+            snprintf(l1,sizeof(l1),"Year Income : Rs. %s", money_str(yi)); print_centered_in_container(l1, C_B_GREEN);
+            snprintf(l2,sizeof(l2),"Year Expense: Rs. %s", money_str(ye)); print_centered_in_container(l2, C_B_RED);
+            snprintf(l3,sizeof(l3),"Year Savings: Rs. %s", money_str(yi-ye)); print_centered_in_container(l3, C_YELLOW);
 
             if (months_present < 12) {
                 char tmp[128]; snprintf(tmp,sizeof(tmp),"Note: data present for %d month(s).", months_present);
                 print_centered_in_container(tmp, C_RESET);
             }
             wait_enter_center();
+        } else if (c[0] == '3') {
+            char from[32], to[32], kind[16], names[256];
+            int d1,m1,y1,d2,m2,y2;
+            get_input("From date (DD/MM/YYYY)", from, sizeof(from));
+            get_input("To date (DD/MM/YYYY)", to, sizeof(to));
+            if (!is_valid_date(from) || !is_valid_date(to)) { print_error("Invalid date."); wait_enter_center(); continue; }
+            sscanf(from,"%d/%d/%d",&d1,&m1,&y1); sscanf(to,"%d/%d/%d",&d2,&m2,&y2);
+            get_input("Type (I/E, blank for both)", kind, sizeof(kind));
+            get_input("Categories, comma separated (blank for all)", names, sizeof(names));
+            RangeQuery q;
+            q.date_lo = (int)pack_date(d1, m1, y1); q.date_hi = (int)pack_date(d2, m2, y2);
+            q.type = (kind[0]=='I' || kind[0]=='i') ? TXN_INCOME : (kind[0]=='E' || kind[0]=='e') ? TXN_EXPENSE : -1;
+            q.cat_sel = NULL;
+            int *sel = NULL, bad = 0;
+            if (names[0]) {
+                sel = calloc(MAX_CATS, sizeof(int));  // query_range may fault in years that add categories
+                if (!sel) { print_error("Out of memory."); wait_enter_center(); continue; }
+                for (char *tok = strtok(names, ","); tok; tok = strtok(NULL, ",")) {
+                    while (*tok == ' ') tok++;
+                    size_t n = strlen(tok); while (n && tok[n-1] == ' ') n--;
+                    int id = cat_find(tok, n);
+                    if (id < 0) bad = 1; else sel[id] = 1;
+                }
+                q.cat_sel = sel;
+            }
+            if (bad) { free(sel); print_error("Unknown category."); wait_enter_center(); continue; }
+            RangeStats st; query_range(&q, &st);
+            free(sel);
+            char h_buf[128]; snprintf(h_buf, sizeof(h_buf), "Range %s - %s", from, to);
+            print_header(h_buf);
+            char line[96];
+            snprintf(line,sizeof(line),"Transactions: %ld", st.count); print_centered_in_container(line, C_RESET);
+            snprintf(line,sizeof(line),"Total  : Rs. %s", money_str(st.sum)); print_centered_in_container(line, C_YELLOW);
+            if (st.count) {
+                snprintf(line,sizeof(line),"Average: Rs. %s", money_str(paise_avg(st.sum, st.count))); print_centered_in_container(line, C_RESET);
+                snprintf(line,sizeof(line),"Smallest: Rs. %s  Largest: Rs. %s", money_str(st.min), money_str(st.max)); print_centered_in_container(line, C_RESET);
+            }
+            wait_enter_center();
+        } else if (c[0] == '4' || c[0] == '5') {
+            int whole_year = c[0] == '5', m = 1, y;
+            if (!whole_year) { get_input("Enter month (1-12)", c, sizeof(c)); m = atoi(c); }
+            get_input("Enter year (blank for this year)", c, sizeof(c));
+            int td, tm; today(&td, &tm, &y);
+            if (c[0]) y = atoi(c);
+            if (m < 1 || m > 12 || y < AGG_MIN_YEAR || y > AGG_MAX_YEAR) { print_error("Invalid month or year."); wait_enter_center(); continue; }
+            CatBreakdown b;
+            agg_need_year(y);
+            if (!(b.rows = malloc((lg->cat_count ? lg->cat_count : 1) * sizeof(CatTotal)))) { print_error("Out of memory."); wait_enter_center(); continue; }
+            b.n = cat_totals(y, whole_year ? 1 : m, whole_year ? 12 : m, b.rows);
+            b.income = b.expense = 0;
+            for (int i = 0; i < b.n; ++i) { b.income += b.rows[i].income; b.expense += b.rows[i].expense; }
+            char h_buf[128];
+            if (whole_year) snprintf(h_buf, sizeof(h_buf), "Top Categories %04d", y);
+            else snprintf(h_buf, sizeof(h_buf), "Spend by Category %02d/%04d", m, y);
+            list_view(h_buf, b.n, cat_breakdown_row, &b);
+            free(b.rows);
+            continue;
+        } else if (c[0] == '6') {
+            char date[32]; int d, m, y;
+            get_input("As of date (DD/MM/YYYY, blank for today)", date, sizeof(date));
+            if (!date[0]) { today(&d, &m, &y); snprintf(date, sizeof(date), "%02d/%02d/%04d", d, m, y); }
+            if (!is_valid_date(date)) { print_error("Invalid date."); wait_enter_center(); continue; }
+            sscanf(date, "%d/%d/%d", &d, &m, &y);
+            int64_t bal = balance_as_of((int)pack_date(d, m, y)), opening = flow_before((int)pack_date(1, m, y));
+            char h_buf[128]; snprintf(h_buf, sizeof(h_buf), "Balance as of %s", date);
+            print_header(h_buf);
+            char l1[80], l2[80];
+            snprintf(l1, sizeof(l1), "Balance          : Rs. %s", money_str(bal)); print_centered_in_container(l1, bal < 0 ? C_B_RED : C_B_GREEN);
+            snprintf(l2, sizeof(l2), "Since %02d/%02d/%04d : Rs. %s", 1, m, y, money_str(bal - opening)); print_centered_in_container(l2, C_YELLOW);
+            wait_enter_center();
+        } else if (c[0] == '7') {
+            char from[32], to[32]; int d1, m1, y1, d2, m2, y2;
+            get_input("From date (DD/MM/YYYY)", from, sizeof(from));
+            get_input("To date (DD/MM/YYYY)", to, sizeof(to));
+            if (!is_valid_date(from) || !is_valid_date(to)) { print_error("Invalid date."); wait_enter_center(); continue; }
+            sscanf(from, "%d/%d/%d", &d1, &m1, &y1); sscanf(to, "%d/%d/%d", &d2, &m2, &y2);
+            int lo = (int)pack_date(d1, m1, y1), hi = (int)pack_date(d2, m2, y2);
+            if (lo > hi) { print_error("From date is after the to date."); wait_enter_center(); continue; }
+            int64_t opening = flow_before(lo), closing = balance_as_of(hi);
+            char h_buf[128]; snprintf(h_buf, sizeof(h_buf), "Net Flow %s - %s", from, to);
+            print_header(h_buf);
+            char l1[80], l2[80], l3[80];
+            snprintf(l1, sizeof(l1), "Opening balance: Rs. %s", money_str(opening)); print_centered_in_container(l1, C_RESET);
+            snprintf(l2, sizeof(l2), "Net flow       : Rs. %s", money_str(closing - opening)); print_centered_in_container(l2, closing < opening ? C_B_RED : C_B_GREEN);
+            snprintf(l3, sizeof(l3), "Closing balance: Rs. %s", money_str(closing)); print_centered_in_container(l3, C_YELLOW);
+            wait_enter_center();
         } else { print_error("Invalid choice."); wait_enter_center(); }
         print_footer();
     }
@@ -754,8 +4502,10 @@ void view_summary_menu(void) {
 void set_budget_menu(void) {
     print_header("SET BUDGET");
     char b[64]; get_input("Enter monthly budget amount (0 to disable)", b, sizeof(b));
-    monthly_budget = atof(b);
-    save_settings_for_user(cur_user);
+    int64_t budget;
+    if (!parse_money(b, &budget) || budget < 0) { print_error("Invalid amount."); wait_enter_center(); print_footer(); return; }
+    lg->monthly_budget = budget;
+    save_settings_for_user(lg->user);
     print_success("Budget saved.");
     wait_enter_center();
     print_footer();
@@ -763,95 +4513,111 @@ void set_budget_menu(void) {
 
 void generate_export_report(void) {
     print_header("GENERATE & EXPORT REPORT");
-    char buf[32]; 
-    get_input("Enter month (1-12)", buf, sizeof(buf)); 
-    int m = atoi(buf);
-    get_input("Enter year (YYYY)", buf, sizeof(buf)); 
-    int y = atoi(buf);
-
-    if (m < 1 || m > 12 || y < 1900 || y > 9999) {
-        print_error("Invalid month or year. Aborting.");
-        wait_enter_center(); 
-        print_footer();
-        return;
-    }
-
-    char fname[128]; snprintf(fname,sizeof(fname),"report_%s_%02d-%04d.txt", cur_user, m, y);
-    FILE *f = fopen(fname, "w");
-    if (!f) { print_error("Failed to create report file."); wait_enter_center(); print_footer(); return; }
-
-    fprintf(f, "================================================================================\n");
-    fprintf(f, "                      FINANCIAL REPORT: %02d/%04d\n", m, y);
-    fprintf(f, "                             User: %s\n", cur_user);
-    fprintf(f, "================================================================================\n");
- 
-    fprintf(f, "  ID | DATE       | TYPE     | CATEGORY           | AMOUNT (Rs) | NOTE\n");
-    fprintf(f, "--------------------------------------------------------------------------------\n");
-    
-    int found_count = 0;
-    double total_income = 0.0;
-    double total_expense = 0.0;
-
-    for (int i=0;i<txn_count;i++) if (txns[i].month==m && txns[i].year==y) {
-        found_count++;
-        
-        if (strcmp(txns[i].type, "Income") == 0) total_income += txns[i].amount;
-        else total_expense += txns[i].amount;
-        
-        char safe_note[192]; snprintf(safe_note, sizeof(safe_note), "%.30s", txns[i].note);
-        
-        fprintf(f, "%4d | %02d/%02d/%04d | %-8s | %-18s | %11.2f | %s\n", 
-                txns[i].id, txns[i].day, txns[i].month, txns[i].year, 
-                txns[i].type, txns[i].category, txns[i].amount, 
-                safe_note);
-    }
-    
-    fprintf(f, "--------------------------------------------------------------------------------\n");
-    if (found_count == 0) {
-        fprintf(f, "                             No transactions recorded for this period.\n");
+    print_left_in_container("1) Single month", C_RESET);
+    print_left_in_container("2) Date range", C_RESET);
+    print_left_in_container("3) Category breakdown for a year", C_RESET);
+    char buf[32], from[32], to[32];
+    get_input("Choice", buf, sizeof(buf));
+    int lo, hi, by_cat = 0; char title[80], fname[192];
+
+    if (buf[0] == '3') {
+        get_input("Enter year (YYYY)", buf, sizeof(buf));
+        int y = atoi(buf);
+        if (y < 1900 || y > 9999) { print_error("Invalid year. Aborting."); wait_enter_center(); print_footer(); return; }
+        lo = hi = y; by_cat = 1;
+        snprintf(title, sizeof(title), "%04d", y);
+        snprintf(fname, sizeof(fname), "report_%s_categories_%04d", lg->user, y);
+    } else if (buf[0] == '2') {
+        get_input("From date DD/MM/YYYY", from, sizeof(from));
+        get_input("To date DD/MM/YYYY", to, sizeof(to));
+        int d1,m1,y1,d2,m2,y2;
+        if (!is_valid_date(from) || !is_valid_date(to)) { print_error("Invalid date format. Aborting."); wait_enter_center(); print_footer(); return; }
+        sscanf(from,"%d/%d/%d",&d1,&m1,&y1); sscanf(to,"%d/%d/%d",&d2,&m2,&y2);
+        lo = (int)pack_date(d1, m1, y1); hi = (int)pack_date(d2, m2, y2);
+        if (lo > hi) { print_error("From date is after To date. Aborting."); wait_enter_center(); print_footer(); return; }
+        snprintf(title, sizeof(title), "%s - %s", from, to);
+        snprintf(fname, sizeof(fname), "report_%s_%08d-%08d", lg->user, lo, hi);
     } else {
-        fprintf(f, "TOTAL INCOME:                                                 %11.2f\n", total_income);
-        fprintf(f, "TOTAL EXPENSE:                                                %11.2f\n", total_expense);
-        fprintf(f, "NET BALANCE:                                                  %11.2f\n", total_income - total_expense);
+        get_input("Enter month (1-12)", buf, sizeof(buf)); 
+        int m = atoi(buf);
+        get_input("Enter year (YYYY)", buf, sizeof(buf)); 
+        int y = atoi(buf);
+
+        if (m < 1 || m > 12 || y < 1900 || y > 9999) {
+            print_error("Invalid month or year. Aborting.");
+            wait_enter_center(); 
+            print_footer();
+            return;
+        }
+        lo = (int)pack_date(0, m, y); hi = (int)pack_date(99, m, y);
+        snprintf(title, sizeof(title), "%02d/%04d", m, y);
+        snprintf(fname, sizeof(fname), "report_%s_%02d-%04d", lg->user, m, y);
     }
-    fprintf(f, "================================================================================\n");
 
-    fclose(f);
-    char mmsg[128]; snprintf(mmsg,sizeof(mmsg),"Saved to: %s", fname);
-    print_success("Report exported successfully (TXT format).");
+    print_left_in_container("Format: 1) TXT  2) CSV  3) JSON lines", C_RESET);
+    get_input("Choice", buf, sizeof(buf));
+    int fmt = buf[0] == '2' ? REPORT_CSV : buf[0] == '3' ? REPORT_JSONL : REPORT_TXT;
+    size_t fl = strlen(fname); snprintf(fname + fl, sizeof(fname) - fl, ".%s", report_ext(fmt));
+
+    ReportTotals tot;
+    ledger_refresh();
+    if (!(by_cat ? write_category_report(fname, fmt, lo, &tot) : write_report(fname, fmt, lo, hi, title, &tot))) { print_error("Failed to write report file."); wait_enter_center(); print_footer(); return; }
+
+    char mmsg[256]; snprintf(mmsg,sizeof(mmsg),"Saved to: %s", fname);
+    snprintf(buf, sizeof(buf), "Report exported (%s).", fmt == REPORT_CSV ? "CSV" : fmt == REPORT_JSONL ? "JSONL" : "TXT");
+    print_success(buf);
+    print_centered_in_container(mmsg, C_RESET);
+    snprintf(mmsg, sizeof(mmsg), "%ld transactions, net Rs. %s", tot.rows, money_str(tot.income - tot.expense));
     print_centered_in_container(mmsg, C_RESET);
     wait_enter_center();
     print_footer();
 }
 
+void diagnostics_menu(void) {
+    while (1) {
+        print_header("DIAGNOSTICS");
+        stats_lines(stats_line_to_screen, NULL, 0);
+        print_separator_in_container();
+        print_left_in_container("1) Refresh", C_RESET);
+        print_left_in_container("2) Dump to file (with latency histograms)", C_RESET);
+        print_left_in_container("3) Reset counters", C_RESET);
+        print_left_in_container("0) Back", C_RESET);
+        char c[64]; get_input("Choice", c, sizeof(c));
+        if (c[0]=='0') { print_footer(); return; }
+        if (c[0]=='2') {
+            time_t now = time(NULL); struct tm *tm = localtime(&now);
+            char fname[192];
+            snprintf(fname, sizeof(fname), "diagnostics_%s_%04d%02d%02d_%02d%02d%02d.txt", lg->user,
+                     tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec);
+            FILE *f = fopen(fname, "w");
+            if (!f) { print_error("Could not create the file."); wait_enter_center(); continue; }
+            stats_lines(stats_line_to_file, f, 1);
+            if (fclose(f) != 0) { print_error("Could not write the file."); wait_enter_center(); continue; }
+            print_success("Diagnostics written to:"); print_centered_in_container(fname, C_CYAN);
+            wait_enter_center();
+        } else if (c[0]=='3') {
+            stats_reset();
+        } else if (c[0]!='1') { print_error("Invalid choice."); wait_enter_center(); }
+        print_footer();
+    }
+}
+
 void settings_menu(void) {
     while (1) {
         print_header("SETTINGS");
         print_left_in_container("1) Change password", C_RESET);
         print_left_in_container("2) About", C_RESET);
+        print_left_in_container("3) Diagnostics", C_RESET);
         print_left_in_container("0) Back", C_RESET);
         char c[64]; get_input("Choice", c, sizeof(c));
         if (c[0]=='0') { print_footer(); return; }
         if (c[0]=='1') {
             char curp[128], np[128]; 
             get_input("Enter current password", curp, sizeof(curp));
-            if (!verify_user_file(cur_user, curp)) { print_error("Incorrect current password."); wait_enter_center(); continue; }
+            if (!verify_user_file(lg->user, curp)) { print_error("Incorrect current password."); wait_enter_center(); continue; }
             get_input("Enter new password", np, sizeof(np));
             
-            FILE *f = fopen(USERS_CSV, "r"); if (!f) return;
-            FILE *t = fopen("users_tmp.csv", "w"); if (!t) { fclose(f); return; }
-            char line[MAX_LINE];
-            while (fgets(line, sizeof(line), f)) {
-                char u[64], penc[128];
-                if (sscanf(line, "%63[^,],%127[^\n]", u, penc) == 2) {
-                    if (strcmp(u, cur_user) == 0) {
-                        char enc[128]; strncpy(enc, np, sizeof(enc)-1); enc[sizeof(enc)-1]='\0'; xor_str(enc);
-                        fprintf(t, "%s,%s\n", u, enc);
-                    } else fprintf(t, "%s", line);
-                }
-            }
-            fclose(f); fclose(t);
-            remove(USERS_CSV); rename("users_tmp.csv", USERS_CSV);
+            if (!user_set_password(lg->user, np)) { print_error("Could not save new password."); wait_enter_center(); continue; }
             print_success("Password changed."); wait_enter_center();
         } else if (c[0]=='2') {
             print_header("ABOUT");
@@ -860,6 +4626,8 @@ void settings_menu(void) {
             print_centered_in_container("FAST-NUCES Karachi", C_RESET);
             print_centered_in_container("This console application was built as a semester project.", C_RESET);
             wait_enter_center();
+        } else if (c[0]=='3') {
+            diagnostics_menu();
         } else { print_error("Invalid choice."); wait_enter_center(); }
         print_footer();
     }